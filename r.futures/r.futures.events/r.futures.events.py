@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+##############################################################################
+#
+# MODULE:       r.futures.events
+#
+# AUTHOR(S):    Anna Petrasova (kratochanna gmail.com)
+#               Vaclav Petras (wenzeslaus gmail.com)
+#
+# PURPOSE:      Recreate FUTURES output from the log of developed cells
+#
+# COPYRIGHT:    (C) 2020 by the GRASS Development Team
+#
+#               This program is free software under the GNU General Public
+#               License (>=v2). Read the file COPYING that comes with GRASS
+#               for details.
+#
+##############################################################################
+
+#%module
+#% description: Recreates output of r.futures.pga from the log of developed cells
+#% keyword: raster
+#% keyword: patch growing
+#% keyword: urban
+#%end
+#%option G_OPT_F_INPUT
+#% description: Event log written by r.futures.pga
+#%end
+#%option G_OPT_R_INPUT
+#% key: developed
+#% description: Raster map of developed areas (=1), undeveloped (=0) and excluded (no data) used in the simulation
+#%end
+#%option G_OPT_R_OUTPUT
+#%end
+#%option
+#% key: step
+#% type: integer
+#% label: Step of the simulation
+#% description: If not specified, the final output is created, otherwise the map of developed areas in the step
+#% required: no
+#%end
+
+
+import sys
+import numpy as np
+
+import grass.script as gscript
+from grass.script import array as garray
+
+
+NULL = -2147483648
+CELL_ID_BLOCK_BITS = 16
+MAGIC = b'FUTEVLOG'
+VERSION = 2
+BYTE_ORDER = 0x01020304
+
+HEADER = np.dtype([('magic', 'S8'), ('version', '<u4'), ('byte_order', '<u4'),
+                   ('rows', '<i4'), ('cols', '<i4'),
+                   ('north', '<f8'), ('south', '<f8'), ('east', '<f8'), ('west', '<f8'),
+                   ('num_events', '<u8'), ('num_patches', '<u4'), ('num_regions', '<i4')])
+EVENT = np.dtype([('id_block', '<u4'), ('id_in_block', '<u2'), ('step', '<u2'),
+                  ('region', '<i4'), ('patch', '<u4')])
+
+
+def read_events(filename):
+    """Read event log, returns header, subregion categories, cells with data and events"""
+    with open(filename, 'rb') as f:
+        header = np.fromfile(f, dtype=HEADER, count=1)
+        if len(header) != 1 or header['magic'][0] != MAGIC:
+            gscript.fatal(_("File <{}> is not an event log").format(filename))
+        region_dtype, word_dtype, event_dtype = np.dtype('<i4'), np.dtype('<u8'), EVENT
+        if header['byte_order'][0] != BYTE_ORDER:
+            # written on a machine with different byte order
+            header = header.view(HEADER.newbyteorder())
+            region_dtype = region_dtype.newbyteorder()
+            word_dtype = word_dtype.newbyteorder()
+            event_dtype = EVENT.newbyteorder()
+        header = header[0]
+        if header['version'] != VERSION:
+            gscript.fatal(_("Unsupported version of event log <{}>").format(filename))
+        regions = np.fromfile(f, dtype=region_dtype, count=header['num_regions'])
+        rows, cols = header['rows'], header['cols']
+        words = (cols + 63) // 64
+        bitmap = np.fromfile(f, dtype=word_dtype, count=rows * words)
+        events = np.fromfile(f, dtype=event_dtype, count=header['num_events'])
+    if len(bitmap) != rows * words or len(events) != header['num_events']:
+        gscript.fatal(_("Event log <{}> is incomplete").format(filename))
+    # bit col % 64 of word col / 64 in each row
+    bits = np.unpackbits(bitmap.astype('<u8').view(np.uint8), bitorder='little')
+    valid = bits.reshape(rows, words * 64)[:, :cols].astype(bool)
+    return header, regions, valid, events
+
+
+def check_region(header, filename):
+    region = gscript.region()
+    if (region['rows'] != header['rows'] or region['cols'] != header['cols']
+            or not np.allclose([region['n'], region['s'], region['e'], region['w']],
+                               [header['north'], header['south'], header['east'], header['west']])):
+        gscript.fatal(_("Computational region differs from the region"
+                        " of the simulation stored in <{}>").format(filename))
+
+
+def main():
+    filename = options['input']
+    developed = options['developed']
+    output = options['output']
+    step = int(options['step']) if options['step'] else None
+
+    header, regions, valid, events = read_events(filename)
+    check_region(header, filename)
+    gscript.verbose(_("{n} developed cells in {p} patches").format(n=header['num_events'],
+                                                                    p=header['num_patches']))
+
+    ids = (events['id_block'].astype(np.int64) << CELL_ID_BLOCK_BITS) | events['id_in_block']
+    cells = garray.array(mapname=developed, null=NULL, dtype=np.int32)
+    flat = cells.reshape(-1)
+    # cells with no data in any of the inputs of the simulation
+    cells[~valid] = NULL
+    if step is None:
+        # undeveloped 0 -> -1, developed 1 -> 0 as in r.futures.pga
+        np.subtract(cells, 1, out=cells, where=valid)
+        flat[ids] = events['step']
+        num_steps = int(events['step'].max()) if len(events) else 1
+        rules = ("-1 180:255:160\n0 200:200:200\n"
+                 "1 255:100:50\n{n} 255:255:0\n".format(n=num_steps))
+    else:
+        cells[...] = np.where(valid & (cells >= 1), 1, NULL)
+        flat[ids[events['step'] <= step]] = 1
+        rules = "1 255:100:50\n"
+    cells.write(mapname=output, null=NULL, overwrite=gscript.overwrite())
+    gscript.write_command('r.colors', map=output, rules='-', stdin=rules, quiet=True)
+    gscript.raster_history(output)
+
+
+if __name__ == "__main__":
+    options, flags = gscript.parser()
+    sys.exit(main())
@@ -0,0 +1,46 @@
+/*!
+   \file cellstates.c
+
+   \brief Development state of cells kept in memory
+
+   Whether a cell is NULL, undeveloped or developed is the most
+   frequent question during the simulation. The states take 2 bits
+   per cell, so they are always kept in memory and the layer
+   of development is read only when the step of development is needed.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <grass/gis.h>
+
+#include "cellstates.h"
+#include "memusage.h"
+
+/*!
+ * \brief Create states with all cells NULL
+ * \param states cell states
+ * \param rows number of rows
+ * \param cols number of columns
+ */
+void CellStates_create(struct CellStates *states, int rows, int cols)
+{
+    states->rows = rows;
+    states->cols = cols;
+    states->bits = tracked_calloc(MEMORY_CELL_INDEX, ((size_t) rows * cols + 3) / 4, 1);
+}
+
+/*!
+ * \brief Free cell states
+ * \param states cell states
+ */
+void CellStates_free(struct CellStates *states)
+{
+    tracked_free(MEMORY_CELL_INDEX, states->bits);
+    states->bits = NULL;
+}
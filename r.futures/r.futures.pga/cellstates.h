@@ -0,0 +1,49 @@
+#ifndef FUTURES_CELLSTATES_H
+#define FUTURES_CELLSTATES_H
+
+#include <stdlib.h>
+
+enum cell_state {STATE_NULL = 0, STATE_UNDEVELOPED = 1, STATE_DEVELOPED = 2};
+
+/* development state of all cells, 2 bits per cell */
+struct CellStates
+{
+    int rows;
+    int cols;
+    unsigned char *bits;
+};
+
+void CellStates_create(struct CellStates *states, int rows, int cols);
+void CellStates_free(struct CellStates *states);
+
+/*!
+ * \brief Get development state of a cell
+ * \param states cell states
+ * \param row row
+ * \param col column
+ * \return state
+ */
+static inline enum cell_state CellStates_get(const struct CellStates *states, int row, int col)
+{
+    size_t idx = (size_t) row * states->cols + col;
+
+    return (enum cell_state) ((states->bits[idx / 4] >> (2 * (idx % 4))) & 3);
+}
+
+/*!
+ * \brief Set development state of a cell
+ * \param states cell states
+ * \param row row
+ * \param col column
+ * \param state new state
+ */
+static inline void CellStates_set(struct CellStates *states, int row, int col,
+                                  enum cell_state state)
+{
+    size_t idx = (size_t) row * states->cols + col;
+    unsigned char *byte = &states->bits[idx / 4];
+
+    *byte = (*byte & ~(3 << (2 * (idx % 4)))) | (state << (2 * (idx % 4)));
+}
+
+#endif // FUTURES_CELLSTATES_H
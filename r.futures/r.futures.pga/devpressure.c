@@ -21,6 +21,7 @@
 
 #include "devpressure.h"
 #include "utils.h"
+#include "memusage.h"
 
 /*!
  * \brief Update development pressure for neighborhood of a single cell
@@ -55,11 +56,13 @@ void update_development_pressure(int row, int col, struct Segments *segments,
                 value = devpressure_info->scaling_factor / pow(dist, devpressure_info->gamma);
             else
                 value = devpressure_info->scaling_factor * exp(-2 * dist / devpressure_info->gamma);
-            Segment_get(&segments->devpressure, (void *)&devpressure_value, i, j);
+            if (CellStates_get(&segments->states, i, j) == STATE_NULL)
+                continue;
+            SegmentLayer_get(&segments->devpressure, (void *)&devpressure_value, i, j);
             if (Rast_is_null_value(&devpressure_value, FCELL_TYPE))
                 continue;
             devpressure_value += value;
-            Segment_put(&segments->devpressure, (void *)&devpressure_value, i, j);
+            SegmentLayer_put(&segments->devpressure, (void *)&devpressure_value, i, j);
             
         }
     }
@@ -91,17 +94,42 @@ void update_development_pressure_precomputed(int row, int col, struct Segments *
             mi = devpressure_info->neighborhood - (row - i);
             mj = devpressure_info->neighborhood - (col - j);
             value = devpressure_info->matrix[mi][mj];
-            if (value > 0) {
-                Segment_get(&segments->devpressure, (void *)&devpressure_value, i, j);
+            /* pressure is used only where development is not NULL */
+            if (value > 0 && CellStates_get(&segments->states, i, j) != STATE_NULL) {
+                SegmentLayer_get(&segments->devpressure, (void *)&devpressure_value, i, j);
                 if (Rast_is_null_value(&devpressure_value, FCELL_TYPE))
                     continue;
                 devpressure_value += value;
-                Segment_put(&segments->devpressure, (void *)&devpressure_value, i, j);
+                SegmentLayer_put(&segments->devpressure, (void *)&devpressure_value, i, j);
             }
         }
     }
 }
 
+/*!
+ * \brief Get upper bound of increase of development pressure in a cell
+ *
+ * Each cell in the neighborhood can be developed only once.
+ * The developed cell itself (infinite value for gravity) is not included
+ * since its pressure is not used anymore.
+ *
+ * \param devpressure_info Development pressure parameters with matrix
+ * \return sum of the matrix
+ */
+double get_max_devpressure_increase(const struct DevPressure *devpressure_info)
+{
+    int i, j;
+    double sum;
+
+    sum = 0;
+    for (i = 0; i < devpressure_info->neighborhood * 2 + 1; i++)
+        for (j = 0; j < devpressure_info->neighborhood * 2 + 1; j++)
+            if ((i != devpressure_info->neighborhood || j != devpressure_info->neighborhood)
+                    && devpressure_info->matrix[i][j] > 0)
+                sum += devpressure_info->matrix[i][j];
+    return sum;
+}
+
 /*!
  * \brief Precompute development pressure matrix to speed up.
  * \param devpressure_info Development pressure parameters and matrix
@@ -112,9 +140,11 @@ void initialize_devpressure_matrix(struct DevPressure *devpressure_info)
     double dist;
     double value;
 
-    devpressure_info->matrix = G_malloc(sizeof(float *) * (devpressure_info->neighborhood * 2 + 1));
+    devpressure_info->matrix = tracked_malloc(MEMORY_DEVPRESSURE,
+                                              sizeof(float *) * (devpressure_info->neighborhood * 2 + 1));
     for (i = 0; i < devpressure_info->neighborhood * 2 + 1; i++)
-        devpressure_info->matrix[i] = G_malloc(sizeof(float) * (devpressure_info->neighborhood * 2 + 1));
+        devpressure_info->matrix[i] = tracked_malloc(MEMORY_DEVPRESSURE,
+                                                     sizeof(float) * (devpressure_info->neighborhood * 2 + 1));
     /* this can be precomputed */
     for (i = 0; i < 2 * devpressure_info->neighborhood + 1; i++) {
         for (j = 0; j < 2 * devpressure_info->neighborhood + 1; j++) {
@@ -21,5 +21,6 @@ void update_development_pressure(int row, int col, struct Segments *segments,
 void update_development_pressure_precomputed(int row, int col, struct Segments *segments,
                                              struct DevPressure *devpressure_info);
 void initialize_devpressure_matrix(struct DevPressure *devpressure_info);
+double get_max_devpressure_increase(const struct DevPressure *devpressure_info);
 
 #endif // FUTURES_DEVPRESSURE_H
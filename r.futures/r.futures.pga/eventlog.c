@@ -0,0 +1,194 @@
+/*!
+   \file eventlog.c
+
+   \brief Log of cells developed during the simulation
+
+   Only a small part of cells is usually developed, so instead of
+   raster maps the simulation can write a record for each developed
+   cell with its step, subregion and patch. Map of any step can be
+   recreated from the log and the initial development
+   (see r.futures.events).
+
+   The file starts with a header with the computational region,
+   followed by categories of subregions (indexed by region in records),
+   a bitmap of cells with data in the simulation (NULL in none of the
+   inputs, 64-bit words for each row) and records in the order cells
+   were developed. The number of records
+   and patches is written to the header when the log is closed.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <string.h>
+
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+
+#include "eventlog.h"
+#include "inputs.h"
+
+#define EVENT_LOG_MAGIC "FUTEVLOG"
+#define EVENT_LOG_VERSION 2
+#define EVENT_LOG_BYTE_ORDER 0x01020304
+
+struct EventLogHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t rows;
+    int32_t cols;
+    double north;
+    double south;
+    double east;
+    double west;
+    uint64_t num_events;
+    uint32_t num_patches;
+    int32_t num_regions;
+};
+
+/*!
+ * \brief Write header with current number of events and patches
+ * \param log event log
+ */
+static void write_header(struct EventLog *log)
+{
+    struct EventLogHeader header;
+    struct Cell_head window;
+
+    G_get_window(&window);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+    header.version = EVENT_LOG_VERSION;
+    header.byte_order = EVENT_LOG_BYTE_ORDER;
+    header.rows = window.rows;
+    header.cols = window.cols;
+    header.north = window.north;
+    header.south = window.south;
+    header.east = window.east;
+    header.west = window.west;
+    header.num_events = log->num_events;
+    header.num_patches = log->num_patches;
+    header.num_regions = log->num_regions;
+    if (fseek(log->file, 0, SEEK_SET) != 0
+            || fwrite(&header, sizeof(header), 1, log->file) != 1)
+        G_fatal_error(_("Failed to write event log <%s>"), log->filename);
+}
+
+/*!
+ * \brief Write buffered events to the file
+ * \param log event log
+ */
+static void write_events(struct EventLog *log)
+{
+    if (log->num_buffered && fwrite(log->buffer, sizeof(struct DevelopmentEvent),
+                                    log->num_buffered, log->file) != (size_t) log->num_buffered)
+        G_fatal_error(_("Failed to write event log <%s>"), log->filename);
+    log->num_buffered = 0;
+}
+
+/*!
+ * \brief Create event log
+ * \param log event log
+ * \param filename name of the file
+ * \param reverse_region_map map from subregion index to category
+ * \param states development state of cells before the simulation
+ */
+void EventLog_open(struct EventLog *log, const char *filename,
+                   const struct KeyValueIntInt *reverse_region_map,
+                   const struct CellStates *states)
+{
+    int i;
+    int32_t category;
+    int value;
+    int row, col, words;
+    uint64_t *row_bits;
+
+    log->filename = filename;
+    if ((log->file = fopen(filename, "wb")) == NULL)
+        G_fatal_error(_("Cannot create event log <%s>"), filename);
+    log->num_events = 0;
+    log->num_patches = 0;
+    log->step = 0;
+    log->region = 0;
+    log->num_buffered = 0;
+    log->buffer = G_malloc(EVENT_LOG_BUFFER * sizeof(struct DevelopmentEvent));
+    log->num_regions = reverse_region_map->nitems;
+    write_header(log);
+    for (i = 0; i < reverse_region_map->nitems; i++) {
+        KeyValueIntInt_find(reverse_region_map, i, &value);
+        category = value;
+        if (fwrite(&category, sizeof(category), 1, log->file) != 1)
+            G_fatal_error(_("Failed to write event log <%s>"), filename);
+    }
+    /* cells NULL in any of the inputs are NULL in the output */
+    words = (states->cols + 63) / 64;
+    row_bits = G_malloc(words * sizeof(uint64_t));
+    for (row = 0; row < states->rows; row++) {
+        memset(row_bits, 0, words * sizeof(uint64_t));
+        for (col = 0; col < states->cols; col++)
+            if (CellStates_get(states, row, col) != STATE_NULL)
+                row_bits[col / 64] |= (uint64_t) 1 << (col % 64);
+        if (fwrite(row_bits, sizeof(uint64_t), words, log->file) != (size_t) words)
+            G_fatal_error(_("Failed to write event log <%s>"), filename);
+    }
+    G_free(row_bits);
+}
+
+/*!
+ * \brief Start a new patch for events added next
+ * \param log event log
+ * \param step step as stored in developed (first step is 1)
+ * \param region index of subregion the patch is grown for
+ */
+void EventLog_start_patch(struct EventLog *log, int step, int region)
+{
+    log->num_patches++;
+    log->step = step;
+    log->region = region;
+}
+
+/*!
+ * \brief Add developed cell to the current patch
+ * \param log event log
+ * \param row row
+ * \param col column
+ */
+void EventLog_add(struct EventLog *log, int row, int col)
+{
+    struct DevelopmentEvent *event;
+    size_t id;
+
+    if (log->num_buffered == EVENT_LOG_BUFFER)
+        write_events(log);
+    id = (size_t) row * Rast_window_cols() + col;
+    event = &log->buffer[log->num_buffered++];
+    event->id_block = id >> CELL_ID_BLOCK_BITS;
+    event->id_in_block = id & (((size_t) 1 << CELL_ID_BLOCK_BITS) - 1);
+    event->step = log->step;
+    event->region = log->region;
+    event->patch = log->num_patches - 1;
+    log->num_events++;
+}
+
+/*!
+ * \brief Write remaining events and counts and close the log
+ * \param log event log
+ */
+void EventLog_close(struct EventLog *log)
+{
+    write_events(log);
+    write_header(log);
+    if (fclose(log->file) != 0)
+        G_fatal_error(_("Failed to write event log <%s>"), log->filename);
+    G_free(log->buffer);
+    G_verbose_message(_("Event log <%s> has %llu developed cells in %u patches"),
+                      log->filename, (unsigned long long) log->num_events, log->num_patches);
+}
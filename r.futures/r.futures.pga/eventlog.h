@@ -0,0 +1,48 @@
+#ifndef FUTURES_EVENTLOG_H
+#define FUTURES_EVENTLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cellstates.h"
+#include "keyvalue.h"
+
+/* number of events written to the file at once */
+#define EVENT_LOG_BUFFER 4096
+
+/* one developed cell as stored in the file (16 bytes) */
+struct DevelopmentEvent
+{
+    // cell id (index in the computational region) split as in UndevelopedCell
+    uint32_t id_block;
+    uint16_t id_in_block;
+    // step as stored in developed (first step is 1)
+    uint16_t step;
+    // index of subregion the patch was grown for
+    int32_t region;
+    // patch id (counted from 0 in the order of growing)
+    uint32_t patch;
+};
+
+struct EventLog
+{
+    const char *filename;
+    FILE *file;
+    uint64_t num_events;
+    uint32_t num_patches;
+    int num_regions;
+    // step and region of the patch being grown
+    int step;
+    int region;
+    struct DevelopmentEvent *buffer;
+    int num_buffered;
+};
+
+void EventLog_open(struct EventLog *log, const char *filename,
+                   const struct KeyValueIntInt *reverse_region_map,
+                   const struct CellStates *states);
+void EventLog_start_patch(struct EventLog *log, int step, int region);
+void EventLog_add(struct EventLog *log, int row, int col);
+void EventLog_close(struct EventLog *log);
+
+#endif // FUTURES_EVENTLOG_H
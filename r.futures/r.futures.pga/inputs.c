@@ -14,7 +14,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <grass/gis.h>
 #include <grass/raster.h>
@@ -23,6 +27,8 @@
 
 #include "keyvalue.h"
 #include "inputs.h"
+#include "memusage.h"
+#include "snapshot.h"
 
 /*!
  * \brief Initialize arrays for transformation of probability values
@@ -34,8 +40,8 @@ void initialize_incentive(struct Potential *potential_info, float exponent)
     int i;
 
     potential_info->incentive_transform_size = 1001;
-    potential_info->incentive_transform = (float *) G_malloc(sizeof(float) *
-                                                             potential_info->incentive_transform_size);
+    potential_info->incentive_transform = (float *) tracked_malloc(MEMORY_TABLES, sizeof(float) *
+                                                                   potential_info->incentive_transform_size);
     i = 0;
     double step = 1. / (potential_info->incentive_transform_size - 1);
     while (i < potential_info->incentive_transform_size) {
@@ -44,25 +50,512 @@ void initialize_incentive(struct Potential *potential_info, float exponent)
     }
 }
 
+struct TileRegion
+{
+    int region;
+    size_t tile;
+};
+
+static int compare_tile_regions(const void *a, const void *b)
+{
+    const struct TileRegion *t1 = a;
+    const struct TileRegion *t2 = b;
+
+    if (t1->region != t2->region)
+        return t1->region < t2->region ? -1 : 1;
+    return t1->tile < t2->tile ? -1 : (t1->tile > t2->tile);
+}
+
+/*!
+ * \brief Assign tiles of one tile row to subregion with most cells in a tile
+ *
+ * Ties go to the subregion with smaller category, tiles without
+ * any cells with data are assigned INT_MAX so that they are stored last.
+ *
+ * \param counts counts of cells of each subregion for each tile column (reset)
+ * \param tile_row tile row
+ * \param ntile_cols number of tile columns
+ * \param[out] tile_regions subregion of each tile
+ */
+static void assign_tile_regions(struct KeyValueIntInt **counts, int tile_row, int ntile_cols,
+                                struct TileRegion *tile_regions)
+{
+    int i, tile_col;
+    int best;
+    size_t tile;
+    struct KeyValueIntInt *kv;
+
+    for (tile_col = 0; tile_col < ntile_cols; tile_col++) {
+        kv = counts[tile_col];
+        tile = (size_t) tile_row * ntile_cols + tile_col;
+        tile_regions[tile].tile = tile;
+        tile_regions[tile].region = INT_MAX;
+        best = 0;
+        for (i = 0; i < kv->nitems; i++) {
+            if (kv->value[i] > best
+                    || (kv->value[i] == best && kv->key[i] < tile_regions[tile].region)) {
+                best = kv->value[i];
+                tile_regions[tile].region = kv->key[i];
+            }
+        }
+        KeyValueIntInt_free(kv);
+        counts[tile_col] = KeyValueIntInt_create();
+    }
+}
+
+/* counts of subregions in tiles for ordering tiles by subregion */
+struct TileRegionCounts
+{
+    const struct ValidCells *valid;
+    // counts of cells of each subregion in the current tile row
+    struct KeyValueIntInt **counts;
+    struct TileRegion *tile_regions;
+};
+
+static void TileRegionCounts_create(struct TileRegionCounts *counts,
+                                    const struct ValidCells *valid)
+{
+    int i;
+
+    counts->valid = valid;
+    counts->counts = G_malloc(valid->ntile_cols * sizeof(struct KeyValueIntInt *));
+    for (i = 0; i < valid->ntile_cols; i++)
+        counts->counts[i] = KeyValueIntInt_create();
+    counts->tile_regions = G_malloc((size_t) valid->ntile_rows * valid->ntile_cols
+                                    * sizeof(struct TileRegion));
+}
+
+/*!
+ * \brief Count subregion categories of valid cells in a row
+ *
+ * Rows must be added in order.
+ *
+ * \param counts counts
+ * \param row row
+ * \param regions subregion categories
+ * \param row_valid true for each valid cell in the row
+ */
+static void TileRegionCounts_add_row(struct TileRegionCounts *counts, int row,
+                                     const CELL *regions, const bool *row_valid)
+{
+    const struct ValidCells *valid = counts->valid;
+    int col, tile_col, count;
+
+    for (col = 0; col < valid->cols; col++) {
+        if (!row_valid[col])
+            continue;
+        tile_col = col / valid->tile_cols;
+        if (!KeyValueIntInt_find(counts->counts[tile_col], regions[col], &count))
+            count = 0;
+        KeyValueIntInt_set(counts->counts[tile_col], regions[col], count + 1);
+    }
+    if ((row + 1) % valid->tile_rows == 0 || row == valid->rows - 1)
+        assign_tile_regions(counts->counts, row / valid->tile_rows,
+                            valid->ntile_cols, counts->tile_regions);
+}
+
+/*!
+ * \brief Order tiles by subregions and free counts
+ * \param counts counts with all rows added
+ * \param[out] tile_order position of each tile
+ */
+static void TileRegionCounts_order(struct TileRegionCounts *counts, size_t *tile_order)
+{
+    const struct ValidCells *valid = counts->valid;
+    size_t t, ntiles;
+    int i;
+
+    ntiles = (size_t) valid->ntile_rows * valid->ntile_cols;
+    qsort(counts->tile_regions, ntiles, sizeof(struct TileRegion), compare_tile_regions);
+    for (t = 0; t < ntiles; t++)
+        tile_order[counts->tile_regions[t].tile] = t;
+    for (i = 0; i < valid->ntile_cols; i++)
+        KeyValueIntInt_free(counts->counts[i]);
+    G_free(counts->counts);
+    G_free(counts->tile_regions);
+}
+
+/*!
+ * \brief Map category to index assigned in order of appearance
+ * \param map categories to indices
+ * \param reverse_map indices to categories (can be NULL)
+ * \param category category
+ * \return index of the category
+ */
+static int index_category(struct KeyValueIntInt *map, struct KeyValueIntInt *reverse_map,
+                          int category)
+{
+    int index;
+
+    if (KeyValueIntInt_find(map, category, &index))
+        return index;
+    index = map->nitems;
+    KeyValueIntInt_set(map, category, index);
+    if (reverse_map)
+        KeyValueIntInt_set(reverse_map, index, category);
+    return index;
+}
+
+/*!
+ * \brief Find cells with data in input rasters
+ *
+ * A cell is valid when it is not NULL in development, subregions,
+ * potential subregions, development pressure and weights,
+ * i.e., the same inputs which are propagated as NULLs into development
+ * by read_input_rasters(). NULLs in predictors are not considered,
+ * so these cells are kept and marked as NULL later.
+ *
+ * Subregions are indexed here as well, in the same order as
+ * read_input_rasters() would index them.
+ *
+ * This is an extra pass over the inputs needed only when the cells
+ * with data must be known before the segments are opened or
+ * before a snapshot is written, otherwise read_input_rasters()
+ * finds them while reading the inputs.
+ *
+ * \param inputs raster inputs
+ * \param segments segments with use_weight and use_potential_subregions set
+ * \param valid created index of valid cells to fill in
+ * \param[out] tile_order position of each tile when stored grouped
+ *             by subregion with most cells in the tile (NULL if not needed)
+ * \param[out] region_map subregion categories to indices
+ * \param[out] reverse_region_map subregion indices to categories
+ * \param[out] potential_region_map potential subregion categories to indices
+ */
+void read_valid_cells(struct RasterInputs inputs, const struct Segments *segments,
+                      struct ValidCells *valid, size_t *tile_order,
+                      struct KeyValueIntInt *region_map,
+                      struct KeyValueIntInt *reverse_region_map,
+                      struct KeyValueIntInt *potential_region_map)
+{
+    int row, col;
+    int rows, cols;
+    int i, nfds;
+    int fds[5];
+    RASTER_MAP_TYPE types[5];
+    void *bufs[5];
+    bool *row_valid;
+    struct TileRegionCounts counts;
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+    nfds = 0;
+    fds[nfds] = Rast_open_old(inputs.developed, "");
+    types[nfds++] = CELL_TYPE;
+    fds[nfds] = Rast_open_old(inputs.regions, "");
+    types[nfds++] = CELL_TYPE;
+    fds[nfds] = Rast_open_old(inputs.devpressure, "");
+    types[nfds++] = FCELL_TYPE;
+    if (segments->use_potential_subregions) {
+        fds[nfds] = Rast_open_old(inputs.potential_regions, "");
+        types[nfds++] = CELL_TYPE;
+    }
+    if (segments->use_weight) {
+        fds[nfds] = Rast_open_old(inputs.weights, "");
+        types[nfds++] = FCELL_TYPE;
+    }
+    for (i = 0; i < nfds; i++)
+        bufs[i] = Rast_allocate_buf(types[i]);
+    row_valid = G_malloc(cols * sizeof(bool));
+    if (tile_order)
+        TileRegionCounts_create(&counts, valid);
+
+    for (row = 0; row < rows; row++) {
+        for (col = 0; col < cols; col++)
+            row_valid[col] = true;
+        for (i = 0; i < nfds; i++) {
+            Rast_get_row(fds[i], bufs[i], row, types[i]);
+            for (col = 0; col < cols; col++)
+                if (Rast_is_null_value(G_incr_void_ptr(bufs[i], col * Rast_cell_size(types[i])),
+                                       types[i]))
+                    row_valid[col] = false;
+        }
+        ValidCells_set_row(valid, row, row_valid);
+        /* subregions are the second input, potential subregions the fourth */
+        for (col = 0; col < cols; col++) {
+            if (!Rast_is_c_null_value(&((CELL *) bufs[1])[col]))
+                index_category(region_map, reverse_region_map, ((CELL *) bufs[1])[col]);
+            if (segments->use_potential_subregions
+                    && !Rast_is_c_null_value(&((CELL *) bufs[3])[col]))
+                index_category(potential_region_map, NULL, ((CELL *) bufs[3])[col]);
+        }
+        if (tile_order)
+            TileRegionCounts_add_row(&counts, row, bufs[1], row_valid);
+    }
+    ValidCells_index(valid);
+    if (tile_order)
+        TileRegionCounts_order(&counts, tile_order);
+    G_verbose_message(_("%.1f%% of cells have data"), 100. * valid->count / ((double) rows * cols));
+
+    for (i = 0; i < nfds; i++) {
+        Rast_close(fds[i]);
+        G_free(bufs[i]);
+    }
+    G_free(row_valid);
+}
+
+/*!
+ * \brief Get cells with data and subregions from snapshot
+ *
+ * Same as read_valid_cells() but without reading the input rasters.
+ *
+ * \param snapshot opened snapshot
+ * \param valid created index of valid cells to fill in
+ * \param[out] tile_order position of each tile when stored grouped
+ *             by subregion with most cells in the tile (NULL if not needed)
+ * \param[out] region_map subregion categories to indices
+ * \param[out] reverse_region_map subregion indices to categories
+ * \param[out] potential_region_map potential subregion categories to indices
+ */
+void read_valid_snapshot(const struct Snapshot *snapshot, struct ValidCells *valid,
+                         size_t *tile_order, struct KeyValueIntInt *region_map,
+                         struct KeyValueIntInt *reverse_region_map,
+                         struct KeyValueIntInt *potential_region_map)
+{
+    int row, col;
+    int rows, cols;
+    bool *row_valid;
+    CELL *regions;
+    struct InputRows input_rows;
+    struct TileRegionCounts counts;
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+    Snapshot_get_regions(snapshot, region_map, reverse_region_map, potential_region_map);
+    Snapshot_get_valid_cells(snapshot, valid);
+    if (tile_order) {
+        /* tiles are ordered by categories, the snapshot stores indices */
+        row_valid = G_malloc(cols * sizeof(bool));
+        regions = Rast_allocate_c_buf();
+        TileRegionCounts_create(&counts, valid);
+        for (row = 0; row < rows; row++) {
+            Snapshot_get_row(snapshot, row, &input_rows);
+            for (col = 0; col < cols; col++) {
+                row_valid[col] = ValidCells_is_valid(valid, row, col);
+                if (row_valid[col])
+                    regions[col] = region_map->key[input_rows.subregions[col]];
+            }
+            TileRegionCounts_add_row(&counts, row, regions, row_valid);
+        }
+        TileRegionCounts_order(&counts, tile_order);
+        G_free(row_valid);
+        G_free(regions);
+    }
+    ValidCells_index(valid);
+    G_verbose_message(_("%.1f%% of cells have data"), 100. * valid->count / ((double) rows * cols));
+}
+
+/*!
+ * \brief Get range of values of a raster map
+ * \param name raster map name
+ * \param[out] min minimum
+ * \param[out] max maximum
+ */
+void get_raster_range(const char *name, double *min, double *max)
+{
+    const char *mapset;
+    struct FPRange range;
+    DCELL dmin, dmax;
+
+    mapset = G_find_raster2(name, "");
+    if (mapset == NULL)
+        G_fatal_error(_("Raster map <%s> not found"), name);
+    if (Rast_read_fp_range(name, mapset, &range) != 1)
+        G_fatal_error(_("Unable to read range of raster map <%s>"), name);
+    Rast_get_fp_range_min_max(&range, &dmin, &dmax);
+    if (Rast_is_d_null_value(&dmin) || Rast_is_d_null_value(&dmax))
+        dmin = dmax = 0;
+    *min = dmin;
+    *max = dmax;
+}
+
+/*!
+ * \brief Get range of a predictor including rasters which replace it later
+ * \param inputs raster inputs
+ * \param predictor predictor index
+ * \param[out] min minimum
+ * \param[out] max maximum
+ */
+static void get_predictor_range(struct RasterInputs inputs, int predictor,
+                                double *min, double *max)
+{
+    const struct PredictorChanges *changes = inputs.predictor_changes;
+    double change_min, change_max;
+    int i;
+
+    get_raster_range(inputs.predictors[predictor], min, max);
+    for (i = 0; changes && i < changes->count; i++) {
+        if (changes->predictors[i] != predictor)
+            continue;
+        get_raster_range(changes->rasters[i], &change_min, &change_max);
+        *min = MIN(*min, change_min);
+        *max = MAX(*max, change_max);
+    }
+}
+
+/*!
+ * \brief Set range of aggregated predictors stored as scaled integers
+ *
+ * Bounds of aggregated value are computed from ranges of predictors
+ * (including predictors used later in the simulation) and coefficients.
+ *
+ * \param inputs raster inputs
+ * \param segments opened segments
+ * \param potential Potential table
+ */
+static void set_aggregated_predictor_range(struct RasterInputs inputs,
+                                           struct Segments *segments,
+                                           const struct Potential *potential)
+{
+    int i, j, nlines, ncoefs;
+    double min, max, coef, coef_min, coef_max, sum_min, sum_max;
+
+    if (segments->aggregated_predictor.storage != STORE_SCALED_INT16)
+        return;
+    /* subregions may not be indexed yet, so use all lines of the file */
+    nlines = potential->file_lines->nitems;
+    ncoefs = potential->max_predictors + 2;
+    sum_min = sum_max = 0;
+    for (i = 0; i < potential->max_predictors; i++) {
+        get_predictor_range(inputs, i, &min, &max);
+        coef_min = coef_max = nlines ? potential->file_coefficients[i + 2] : 0;
+        for (j = 1; j < nlines; j++) {
+            coef = potential->file_coefficients[(size_t) j * ncoefs + i + 2];
+            if (coef < coef_min)
+                coef_min = coef;
+            if (coef > coef_max)
+                coef_max = coef;
+        }
+        sum_min += MIN(MIN(coef_min * min, coef_min * max), MIN(coef_max * min, coef_max * max));
+        sum_max += MAX(MAX(coef_min * min, coef_min * max), MAX(coef_max * min, coef_max * max));
+    }
+    SegmentLayer_set_range(&segments->aggregated_predictor, sum_min, sum_max);
+}
+
+static bool reports_deviation(const struct Segments *segments)
+{
+    return segments->aggregated_predictor.storage != STORE_NATIVE
+            || segments->devpressure.storage != STORE_NATIVE;
+}
+
+/*!
+ * \brief Write rows of inputs into segments
+ *
+ * With reduced precision of development pressure or aggregated
+ * predictors, the maximum difference in initial probability
+ * (before incentive and weights) in the row is computed.
+ *
+ * \param segments opened segments
+ * \param potential Potential table
+ * \param input_rows rows of inputs
+ * \param row row
+ * \return maximum difference in probability caused by reduced precision
+ */
+static double put_input_rows(struct Segments *segments, const struct Potential *potential,
+                             const struct InputRows *input_rows, int row)
+{
+    int col;
+    CELL pot_index;
+    double exact, rounded, deviation, max_deviation;
+
+    max_deviation = 0;
+    if (reports_deviation(segments)) {
+        for (col = 0; col < Rast_window_cols(); col++) {
+            if (Rast_is_c_null_value(&input_rows->developed[col]))
+                continue;
+            pot_index = segments->use_potential_subregions ?
+                        input_rows->potential_subregions[col] : input_rows->subregions[col];
+            exact = potential->intercept[pot_index]
+                    + potential->devpressure[pot_index] * input_rows->devpressure[col]
+                    + input_rows->aggregated_predictor[col];
+            rounded = potential->intercept[pot_index]
+                    + potential->devpressure[pot_index]
+                      * SegmentLayer_round(&segments->devpressure, input_rows->devpressure[col])
+                    + SegmentLayer_round(&segments->aggregated_predictor,
+                                         input_rows->aggregated_predictor[col]);
+            deviation = fabs(1.0 / (1.0 + exp(-exact)) - 1.0 / (1.0 + exp(-rounded)));
+            if (deviation > max_deviation)
+                max_deviation = deviation;
+        }
+    }
+
+    SegmentLayer_put_row(&segments->developed, input_rows->developed, row);
+    SegmentLayer_put_row(&segments->devpressure, input_rows->devpressure, row);
+    SegmentLayer_put_row(&segments->subregions, input_rows->subregions, row);
+    if (segments->use_weight)
+        SegmentLayer_put_row(&segments->weight, input_rows->weights, row);
+    if (segments->use_potential_subregions)
+        SegmentLayer_put_row(&segments->potential_subregions,
+                             input_rows->potential_subregions, row);
+    SegmentLayer_put_row(&segments->aggregated_predictor,
+                         input_rows->aggregated_predictor, row);
+    return max_deviation;
+}
+
 /*!
- * \brief Read input rasters into segments.
- * \param inputs
- * \param segments
- * \param segment_info
- * \param region_map
- * \param num_predictors
+ * \brief Flush segments with inputs and report difference caused by reduced precision
+ * \param segments segments
+ * \param max_deviation maximum difference in probability from put_input_rows()
+ */
+static void finish_input_rows(struct Segments *segments, double max_deviation)
+{
+    SegmentLayer_flush(&segments->developed);
+    SegmentLayer_flush(&segments->subregions);
+    SegmentLayer_flush(&segments->devpressure);
+    if (segments->use_weight)
+        SegmentLayer_flush(&segments->weight);
+    if (segments->use_potential_subregions)
+        SegmentLayer_flush(&segments->potential_subregions);
+    SegmentLayer_flush(&segments->aggregated_predictor);
+    if (reports_deviation(segments))
+        G_message(_("Maximum difference in initial probability caused by "
+                    "reduced precision: %g"), max_deviation);
+}
+
+/*!
+ * \brief Read input rasters and predictors into segments in one pass
+ *
+ * Development, subregions, development pressure, weights,
+ * potential subregions and all predictors are read row by row together,
+ * predictors are aggregated with the Potential table:
+ * x_1 * a + x2 * b + ...
+ * which saves memory comparing to having them separately.
+ * NULLs in any of the inputs are propagated into development,
+ * so each row of each layer is written only once.
+ *
+ * Unless read_valid_cells() was used before, cells with data are found
+ * and subregions are indexed in the same pass, each row of the index
+ * of valid cells is set before the row is written to segments.
+ * Coefficients from the Potential table are assigned to subregions
+ * as they are indexed.
+ *
+ * With reduced precision of development pressure or aggregated
+ * predictors, the maximum difference in initial probability
+ * (before incentive and weights) is reported.
+ *
+ * \param inputs raster inputs
+ * \param segments opened segments
+ * \param valid created index of valid cells to fill in
+ *        (NULL if filled in by read_valid_cells())
+ * \param region_map subregion categories to indices
+ * \param reverse_region_map subregion indices to categories
+ * \param potential_region_map potential subregion categories to indices
+ * \param potential Potential table
+ * \param snapshot snapshot being created to write the rows to (or NULL)
  */
 void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
-                        struct SegmentMemory segment_info, struct KeyValueIntInt *region_map,
+                        struct ValidCells *valid, struct KeyValueIntInt *region_map,
                         struct KeyValueIntInt *reverse_region_map,
-                        struct KeyValueIntInt *potential_region_map)
+                        struct KeyValueIntInt *potential_region_map,
+                        struct Potential *potential, struct Snapshot *snapshot)
 {
+    int i;
     int row, col;
     int rows, cols;
     int fd_developed, fd_reg, fd_devpressure, fd_weights, fd_pot_reg;
-    int count_regions, pot_count_regions;
+    int *fds_predictors;
     int region_index, pot_region_index;
-    CELL c;
+    CELL c, pot_index, last_region, last_pot_region;
     FCELL fc;
     bool isnull;
     CELL *developed_row;
@@ -70,12 +563,23 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
     CELL *pot_subregions_row;
     FCELL *devpressure_row;
     FCELL *weights_row;
-
+    FCELL **predictor_rows;
+    FCELL *aggregated_row;
+    bool *row_valid;
+    struct InputRows input_rows;
+    struct KeyValueIntInt *potential_map;
+    double deviation, max_deviation;
 
     rows = Rast_window_rows();
     cols = Rast_window_cols();
-    count_regions = region_index = 0;
-    pot_count_regions = pot_region_index = 0;
+    region_index = pot_region_index = 0;
+    /* categories come in runs, so remember the last one (NULL never matches) */
+    Rast_set_c_null_value(&last_region, 1);
+    Rast_set_c_null_value(&last_pot_region, 1);
+    set_aggregated_predictor_range(inputs, segments, potential);
+    max_deviation = 0;
+    potential_map = segments->use_potential_subregions ? potential_region_map : region_map;
+    assign_potential(potential, potential_map);
 
     /* open existing raster maps for reading */
     fd_developed = Rast_open_old(inputs.developed, "");
@@ -85,46 +589,33 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
     fd_devpressure = Rast_open_old(inputs.devpressure, "");
     if (segments->use_weight)
         fd_weights = Rast_open_old(inputs.weights, "");
+    fds_predictors = G_malloc(potential->max_predictors * sizeof(int));
+    for (i = 0; i < potential->max_predictors; i++)
+        fds_predictors[i] = Rast_open_old(inputs.predictors[i], "");
 
-    /* Segment open developed */
-    if (Segment_open(&segments->developed, G_tempfile(), rows,
-                     cols, segment_info.rows, segment_info.cols,
-                     Rast_cell_size(CELL_TYPE), segment_info.in_memory) != 1)
-        G_fatal_error(_("Cannot create temporary file with segments of a raster map of development"));
-    /* Segment open subregions */
-    if (Segment_open(&segments->subregions, G_tempfile(), rows,
-                     cols, segment_info.rows, segment_info.cols,
-                     Rast_cell_size(CELL_TYPE), segment_info.in_memory) != 1)
-        G_fatal_error(_("Cannot create temporary file with segments of a raster map of subregions"));
-    /* Segment open development pressure */
-    if (Segment_open(&segments->devpressure, G_tempfile(), rows,
-                     cols, segment_info.rows, segment_info.cols,
-                     Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
-        G_fatal_error(_("Cannot create temporary file with segments of a raster map of development pressure"));
-    /* Segment open weights */
-    if (segments->use_weight)
-        if (Segment_open(&segments->weight, G_tempfile(), rows,
-                         cols, segment_info.rows, segment_info.cols,
-                         Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
-            G_fatal_error(_("Cannot create temporary file with segments of a raster map of weights"));
-    /* Segment open potential_subregions */
-    if (segments->use_potential_subregions)
-        if (Segment_open(&segments->potential_subregions, G_tempfile(), rows,
-                         cols, segment_info.rows, segment_info.cols,
-                         Rast_cell_size(CELL_TYPE), segment_info.in_memory) != 1)
-            G_fatal_error(_("Cannot create temporary file with segments of a raster map of weights"));
     developed_row = Rast_allocate_buf(CELL_TYPE);
     subregions_row = Rast_allocate_buf(CELL_TYPE);
     devpressure_row = Rast_allocate_buf(FCELL_TYPE);
-
+    weights_row = NULL;
+    pot_subregions_row = NULL;
     if (segments->use_weight)
         weights_row = Rast_allocate_buf(FCELL_TYPE);
     if (segments->use_potential_subregions)
         pot_subregions_row = Rast_allocate_buf(CELL_TYPE);
+    predictor_rows = G_malloc(potential->max_predictors * sizeof(FCELL *));
+    for (i = 0; i < potential->max_predictors; i++)
+        predictor_rows[i] = Rast_allocate_buf(FCELL_TYPE);
+    aggregated_row = Rast_allocate_buf(FCELL_TYPE);
+    row_valid = valid ? G_malloc(cols * sizeof(bool)) : NULL;
+    input_rows.developed = developed_row;
+    input_rows.subregions = subregions_row;
+    input_rows.potential_subregions = pot_subregions_row;
+    input_rows.devpressure = devpressure_row;
+    input_rows.weights = weights_row;
+    input_rows.aggregated_predictor = aggregated_row;
 
     for (row = 0; row < rows; row++) {
         G_percent(row, rows, 5);
-        /* read developed row */
         Rast_get_row(fd_developed, developed_row, row, CELL_TYPE);
         Rast_get_row(fd_devpressure, devpressure_row, row, FCELL_TYPE);
         Rast_get_row(fd_reg, subregions_row, row, CELL_TYPE);
@@ -132,53 +623,53 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
             Rast_get_row(fd_weights, weights_row, row, FCELL_TYPE);
         if (segments->use_potential_subregions)
             Rast_get_row(fd_pot_reg, pot_subregions_row, row, CELL_TYPE);
+        for (i = 0; i < potential->max_predictors; i++)
+            Rast_get_row(fds_predictors[i], predictor_rows[i], row, FCELL_TYPE);
         for (col = 0; col < cols; col++) {
             isnull = false;
+            aggregated_row[col] = 0;
             /* developed */
             /* undeveloped 0 -> -1, developed 1 -> 0 */
-            if (!Rast_is_null_value(&((CELL *) developed_row)[col], CELL_TYPE)) {
-                c = ((CELL *) developed_row)[col];
-                ((CELL *) developed_row)[col] = c - 1;
+            if (!Rast_is_null_value(&developed_row[col], CELL_TYPE)) {
+                c = developed_row[col];
+                developed_row[col] = c - 1;
             }
             else
                 isnull = true;
             /* subregions */
-            if (!Rast_is_null_value(&((CELL *) subregions_row)[col], CELL_TYPE)) {
-                c = ((CELL *) subregions_row)[col];
-                if (!KeyValueIntInt_find(region_map, c, &region_index)) {
-                    KeyValueIntInt_set(region_map, c, count_regions);
-                    KeyValueIntInt_set(reverse_region_map, count_regions, c);
-                    region_index = count_regions;
-                    count_regions++;
+            if (!Rast_is_null_value(&subregions_row[col], CELL_TYPE)) {
+                if (subregions_row[col] != last_region) {
+                    last_region = subregions_row[col];
+                    region_index = index_category(region_map, reverse_region_map,
+                                                  last_region);
                 }
-                ((CELL *) subregions_row)[col] = region_index;
+                subregions_row[col] = region_index;
             }
             else
                 isnull = true;
             if (segments->use_potential_subregions) {
-                if (!Rast_is_null_value(&((CELL *) pot_subregions_row)[col], CELL_TYPE)) {
-                    c = ((CELL *) pot_subregions_row)[col];
-                    if (!KeyValueIntInt_find(potential_region_map, c, &pot_region_index)) {
-                        KeyValueIntInt_set(potential_region_map, c, pot_count_regions);
-                        pot_region_index = pot_count_regions;
-                        pot_count_regions++;
+                if (!Rast_is_null_value(&pot_subregions_row[col], CELL_TYPE)) {
+                    if (pot_subregions_row[col] != last_pot_region) {
+                        last_pot_region = pot_subregions_row[col];
+                        pot_region_index = index_category(potential_region_map, NULL,
+                                                          last_pot_region);
                     }
-                    ((CELL *) pot_subregions_row)[col] = pot_region_index;
+                    pot_subregions_row[col] = pot_region_index;
                 }
                 else
                     isnull = true;
             }
             /* devpressure - just check nulls */
-            if (Rast_is_null_value(&((FCELL *) devpressure_row)[col], FCELL_TYPE))
+            if (Rast_is_null_value(&devpressure_row[col], FCELL_TYPE))
                 isnull = true;
             /* weights - must be in range -1, 1*/
             if (segments->use_weight) {
-                if (Rast_is_null_value(&((FCELL *) weights_row)[col], FCELL_TYPE)) {
-                    ((FCELL *) weights_row)[col] = 0;
+                if (Rast_is_null_value(&weights_row[col], FCELL_TYPE)) {
+                    weights_row[col] = 0;
                     isnull = true;
                 }
                 else {
-                    fc = ((FCELL *) weights_row)[col];
+                    fc = weights_row[col];
                     if (fc > 1) {
                         G_warning(_("Probability weights are > 1, truncating..."));
                         fc = 1;
@@ -187,33 +678,49 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
                         fc = -1;
                         G_warning(_("Probability weights are < -1, truncating..."));
                     }
-                    ((FCELL *) weights_row)[col] = fc;
+                    weights_row[col] = fc;
+                }
+            }
+            /* NULLs in predictors are not considered as in read_valid_cells() */
+            if (row_valid)
+                row_valid[col] = !isnull;
+            if (!isnull) {
+                pot_index = segments->use_potential_subregions ?
+                            pot_subregions_row[col] : subregions_row[col];
+                if (pot_index >= potential->max_subregions)
+                    assign_potential(potential, potential_map);
+                for (i = 0; i < potential->max_predictors; i++) {
+                    /* collect all nulls in predictors */
+                    if (Rast_is_null_value(&predictor_rows[i][col], FCELL_TYPE)) {
+                        isnull = true;
+                        break;
+                    }
+                    aggregated_row[col] += potential->predictors[i][pot_index]
+                            * predictor_rows[i][col];
                 }
             }
-            /* if in developed, subregions, devpressure or weights are any nulls
-               propagate them into developed */
+            /* if in developed, subregions, devpressure, weights or predictors
+               are any nulls propagate them into developed */
             if (isnull)
-                Rast_set_c_null_value(&((CELL *) developed_row)[col], 1);
+                Rast_set_c_null_value(&developed_row[col], 1);
         }
-
-        Segment_put_row(&segments->developed, developed_row, row);
-        Segment_put_row(&segments->devpressure, devpressure_row, row);
-        Segment_put_row(&segments->subregions, subregions_row, row);
-        if (segments->use_weight)
-            Segment_put_row(&segments->weight, weights_row, row);
-        if (segments->use_potential_subregions)
-            Segment_put_row(&segments->potential_subregions, pot_subregions_row, row);
+        if (valid)
+            ValidCells_set_row(valid, row, row_valid);
+        deviation = put_input_rows(segments, potential, &input_rows, row);
+        if (deviation > max_deviation)
+            max_deviation = deviation;
+        if (snapshot)
+            Snapshot_write_row(snapshot, &input_rows);
     }
     G_percent(row, rows, 5);
-
-    /* flush all segments */
-    Segment_flush(&segments->developed);
-    Segment_flush(&segments->subregions);
-    Segment_flush(&segments->devpressure);
-    if (segments->use_weight)
-        Segment_flush(&segments->weight);
-    if (segments->use_potential_subregions)
-        Segment_flush(&segments->potential_subregions);
+    finish_input_rows(segments, max_deviation);
+    /* subregions without any cells with data */
+    assign_potential(potential, potential_map);
+    if (valid) {
+        ValidCells_index(valid);
+        G_verbose_message(_("%.1f%% of cells have data"),
+                          100. * valid->count / ((double) rows * cols));
+    }
 
     /* close raster maps */
     Rast_close(fd_developed);
@@ -223,97 +730,108 @@ void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
         Rast_close(fd_weights);
     if (segments->use_potential_subregions)
         Rast_close(fd_pot_reg);
+    for (i = 0; i < potential->max_predictors; i++) {
+        Rast_close(fds_predictors[i]);
+        G_free(predictor_rows[i]);
+    }
 
     G_free(developed_row);
     G_free(subregions_row);
     G_free(devpressure_row);
-
     if (segments->use_weight)
         G_free(weights_row);
     if (segments->use_potential_subregions)
         G_free(pot_subregions_row);
+    G_free(fds_predictors);
+    G_free(predictor_rows);
+    G_free(aggregated_row);
+    G_free(row_valid);
 }
 
 /*!
- * \brief Reads predictors and aggregates them with Potential table:
- * x_1 * a + x2 * b + ...
- * Saves memory comparing to having them separately.
+ * \brief Read inputs from snapshot into segments
  *
- * \param inputs Raster inputs
- * \param segments Segments
+ * Rows are the same as read_input_rasters() would produce,
+ * so only the rows are copied into segments.
+ *
+ * \param inputs raster inputs
+ * \param segments opened segments
  * \param potential Potential table
- * \param segment_info Segment memory info
+ * \param snapshot opened snapshot
  */
-void read_predictors(struct RasterInputs inputs, struct Segments *segments,
-                     const struct Potential *potential,
-                     const struct SegmentMemory segment_info)
+void read_input_snapshot(struct RasterInputs inputs, struct Segments *segments,
+                         const struct Potential *potential, const struct Snapshot *snapshot)
 {
-    int i;
-    int row, col;
-    int rows, cols;
-    int *fds_predictors;
-    FCELL value;
-    CELL pot_index, dev_value;
-    FCELL **predictor_rows;
-    FCELL *aggregated_row;
+    int row, rows;
+    struct InputRows input_rows;
+    double deviation, max_deviation;
 
     rows = Rast_window_rows();
-    cols = Rast_window_cols();
-    fds_predictors = G_malloc(potential->max_predictors * sizeof(int));
-    for (i = 0; i < potential->max_predictors; i++) {
-        fds_predictors[i] = Rast_open_old(inputs.predictors[i], "");
-    }
-    predictor_rows = G_malloc(potential->max_predictors * sizeof(FCELL *));
-    for (i = 0; i < potential->max_predictors; i++) {
-        predictor_rows[i] = Rast_allocate_buf(FCELL_TYPE);
+    set_aggregated_predictor_range(inputs, segments, potential);
+    max_deviation = 0;
+    for (row = 0; row < rows; row++) {
+        G_percent(row, rows, 5);
+        Snapshot_get_row(snapshot, row, &input_rows);
+        deviation = put_input_rows(segments, potential, &input_rows, row);
+        if (deviation > max_deviation)
+            max_deviation = deviation;
     }
-    aggregated_row = Rast_allocate_buf(FCELL_TYPE);
+    G_percent(row, rows, 5);
+    finish_input_rows(segments, max_deviation);
+}
 
-    /* Segment open predictors */
-    if (Segment_open(&segments->aggregated_predictor, G_tempfile(), rows,
-                     cols, segment_info.rows, segment_info.cols,
-                     Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
-        G_fatal_error(_("Cannot create temporary file with segments of predictor raster maps"));
 
-    /* read in */
-    for (row = 0; row < rows; row++) {
-        for (i = 0; i < potential->max_predictors; i++) {
-            Rast_get_row(fds_predictors[i], predictor_rows[i], row, FCELL_TYPE);
-        }
-        for (col = 0; col < cols; col++) {
-            ((FCELL *) aggregated_row)[col] = 0;
-            Segment_get(&segments->developed, (void *)&dev_value, row, col);
-            if (Rast_is_null_value(&dev_value, CELL_TYPE)) {
-                continue;
-            }
-            for (i = 0; i < potential->max_predictors; i++) {
-                /* collect all nulls in predictors and set it in output raster */
-                if (Rast_is_null_value(&((FCELL *) predictor_rows[i])[col], FCELL_TYPE)) {
-                    Rast_set_c_null_value(&dev_value, 1);
-                    Segment_put(&segments->developed, (void *)&dev_value, row, col);
-                    break;
-                }
-                if (segments->use_potential_subregions)
-                    Segment_get(&segments->potential_subregions, (void *)&pot_index, row, col);
-                else
-                    Segment_get(&segments->subregions, (void *)&pot_index, row, col);
-                value = potential->predictors[i][pot_index] * ((FCELL *) predictor_rows[i])[col];
-                ((FCELL *) aggregated_row)[col] += value;
-            }
-        }
-        Segment_put_row(&segments->aggregated_predictor, aggregated_row, row);
-    }
-    Segment_flush(&segments->aggregated_predictor);
-    Segment_flush(&segments->developed);
-    for (i = 0; i < potential->max_predictors; i++) {
-        Rast_close(fds_predictors[i]);
-        G_free(predictor_rows[i]);
-    }
-    G_free(fds_predictors);
-    G_free(predictor_rows);
-    G_free(aggregated_row);
+/*!
+ * \brief Get upper bound of number of steps from demand file
+ *
+ * Each line except for the header is one step.
+ *
+ * \param filename demand file name
+ * \return number of lines without header
+ */
+int get_max_steps(const char *filename)
+{
+    FILE *fp;
+    int c;
+    int countlines = 0;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        G_fatal_error(_("Cannot open population demand file <%s>"), filename);
+    while ((c = getc(fp)) != EOF)
+        if (c == '\n')
+            countlines++;
+    fclose(fp);
+
+    return countlines;
 }
 
+/*!
+ * \brief Get upper bound of number of categories in a raster map
+ *
+ * Uses range of the map, so the data don't have to be read.
+ *
+ * \param name raster map name
+ * \return number of categories or INT_MAX if unknown
+ */
+int get_max_categories(const char *name)
+{
+    const char *mapset;
+    struct Range range;
+    CELL min, max;
+
+    mapset = G_find_raster2(name, "");
+    if (mapset == NULL)
+        G_fatal_error(_("Raster map <%s> not found"), name);
+    if (Rast_map_type(name, mapset) != CELL_TYPE
+            || Rast_read_range(name, mapset, &range) != 1)
+        return INT_MAX;
+    Rast_get_range_min_max(&range, &min, &max);
+    if (Rast_is_c_null_value(&min) || Rast_is_c_null_value(&max))
+        return INT_MAX;
+    if ((double) max - min + 1 > INT_MAX)
+        return INT_MAX;
+    return max - min + 1;
+}
 
 void read_demand_file(struct Demand *demandInfo, struct KeyValueIntInt *region_map)
 {
@@ -355,11 +873,12 @@ void read_demand_file(struct Demand *demandInfo, struct KeyValueIntInt *region_m
     }
 
     int years = 0;
-    demandInfo->table = (int **) G_malloc(region_map->nitems * sizeof(int *));
+    demandInfo->table = (int **) tracked_malloc(MEMORY_TABLES,
+                                                region_map->nitems * sizeof(int *));
     for (int i = 0; i < region_map->nitems; i++) {
-        demandInfo->table[i] = (int *) G_malloc(countlines * sizeof(int));
+        demandInfo->table[i] = (int *) tracked_malloc(MEMORY_TABLES, countlines * sizeof(int));
     }
-    demandInfo->years = (int *) G_malloc(countlines * sizeof(int));
+    demandInfo->years = (int *) tracked_malloc(MEMORY_TABLES, countlines * sizeof(int));
     while(G_getl2(buf, buflen, fp)) {
         if (buf[0] == '\0')
             continue;
@@ -394,8 +913,17 @@ void read_demand_file(struct Demand *demandInfo, struct KeyValueIntInt *region_m
     G_free_tokens(tokens);
 }
 
-void read_potential_file(struct Potential *potentialInfo, struct KeyValueIntInt *region_map,
-                         int num_predictors)
+/*!
+ * \brief Read Potential table
+ *
+ * Coefficients are kept in order of lines in the file
+ * and assigned to subregion indices by assign_potential()
+ * once the subregions are indexed.
+ *
+ * \param potentialInfo Potential table with filename and separator set
+ * \param num_predictors number of predictors
+ */
+void read_potential_file(struct Potential *potentialInfo, int num_predictors)
 {
     FILE *fp;
     if ((fp = fopen(potentialInfo->filename, "r")) == NULL)
@@ -410,14 +938,17 @@ void read_potential_file(struct Potential *potentialInfo, struct KeyValueIntInt
         G_fatal_error(_("Development potential parameters file <%s>"
                         " contains less than one line"), potentialInfo->filename);
     potentialInfo->max_predictors = num_predictors;
-    potentialInfo->intercept = (double *) G_malloc(region_map->nitems * sizeof(double));
-    potentialInfo->devpressure = (double *) G_malloc(region_map->nitems * sizeof(double));
-    potentialInfo->predictors = (double **) G_malloc(num_predictors * sizeof(double *));
-    for (int i = 0; i < num_predictors; i++) {
-        potentialInfo->predictors[i] = (double *) G_malloc(region_map->nitems * sizeof(double));
-    }
+    potentialInfo->max_subregions = 0;
+    potentialInfo->intercept = NULL;
+    potentialInfo->devpressure = NULL;
+    potentialInfo->predictors = (double **) tracked_calloc(MEMORY_TABLES, num_predictors,
+                                                           sizeof(double *));
+    potentialInfo->file_coefficients = NULL;
+    potentialInfo->file_lines = KeyValueIntInt_create();
 
     char **tokens;
+    int ncoefs = num_predictors + 2;
+    int nlines = 0;
 
     while (G_getl2(buf, buflen, fp)) {
         if (buf[0] == '\0')
@@ -430,28 +961,26 @@ void read_potential_file(struct Potential *potentialInfo, struct KeyValueIntInt
         if (ntokens != num_predictors + 3)
             G_fatal_error(_("Potential: wrong number of columns: %s"), buf);
 
-        int idx;
+        int line;
         int id;
-        double coef_intercept, coef_devpressure;
-        double val;
+        double *coefs;
         int j;
 
         G_chop(tokens[0]);
         id = atoi(tokens[0]);
-        if (KeyValueIntInt_find(region_map, id, &idx)) {
-            G_chop(tokens[1]);
-            coef_intercept = atof(tokens[1]);
-            G_chop(tokens[2]);
-            coef_devpressure = atof(tokens[2]);
-            potentialInfo->intercept[idx] = coef_intercept;
-            potentialInfo->devpressure[idx] = coef_devpressure;
-            for (j = 0; j < num_predictors; j++) {
-                G_chop(tokens[j + 3]);
-                val = atof(tokens[j + 3]);
-                potentialInfo->predictors[j][idx] = val;
-            }
+        // the last line with the same id is used
+        if (!KeyValueIntInt_find(potentialInfo->file_lines, id, &line)) {
+            line = nlines++;
+            KeyValueIntInt_set(potentialInfo->file_lines, id, line);
+            potentialInfo->file_coefficients = (double *) tracked_realloc(
+                        MEMORY_TABLES, potentialInfo->file_coefficients,
+                        (size_t) nlines * ncoefs * sizeof(double));
+        }
+        coefs = potentialInfo->file_coefficients + (size_t) line * ncoefs;
+        for (j = 0; j < ncoefs; j++) {
+            G_chop(tokens[j + 1]);
+            coefs[j] = atof(tokens[j + 1]);
         }
-        // else ignoring the line with region which is not used
 
         G_free_tokens(tokens);
     }
@@ -459,119 +988,687 @@ void read_potential_file(struct Potential *potentialInfo, struct KeyValueIntInt
     fclose(fp);
 }
 
-void read_patch_sizes(struct PatchSizes *patch_sizes,
-                      struct KeyValueIntInt *region_map,
-                      double discount_factor)
+/*!
+ * \brief Assign coefficients from Potential table to subregion indices
+ *
+ * Only subregions indexed since the last call are assigned,
+ * so this can be called repeatedly while the subregions are being indexed.
+ * Subregions not in the file have all coefficients zero.
+ *
+ * \param potential Potential table from read_potential_file()
+ * \param region_map subregion (or potential subregion) categories to indices
+ */
+void assign_potential(struct Potential *potential, const struct KeyValueIntInt *region_map)
+{
+    int i, j, line;
+    int ncoefs = potential->max_predictors + 2;
+    size_t size = region_map->nitems * sizeof(double);
+    const double *coefs;
+
+    if (region_map->nitems <= potential->max_subregions)
+        return;
+    potential->intercept = tracked_realloc(MEMORY_TABLES, potential->intercept, size);
+    potential->devpressure = tracked_realloc(MEMORY_TABLES, potential->devpressure, size);
+    for (j = 0; j < potential->max_predictors; j++)
+        potential->predictors[j] = tracked_realloc(MEMORY_TABLES, potential->predictors[j], size);
+    for (i = potential->max_subregions; i < region_map->nitems; i++) {
+        // keys are stored in order of indices
+        if (KeyValueIntInt_find(potential->file_lines, region_map->key[i], &line)) {
+            coefs = potential->file_coefficients + (size_t) line * ncoefs;
+            potential->intercept[i] = coefs[0];
+            potential->devpressure[i] = coefs[1];
+            for (j = 0; j < potential->max_predictors; j++)
+                potential->predictors[j][i] = coefs[j + 2];
+        }
+        else {
+            potential->intercept[i] = 0;
+            potential->devpressure[i] = 0;
+            for (j = 0; j < potential->max_predictors; j++)
+                potential->predictors[j][i] = 0;
+        }
+    }
+    potential->max_subregions = region_map->nitems;
+}
+
+/*!
+ * \brief Free Potential table
+ * \param potential Potential table
+ */
+void free_potential(struct Potential *potential)
+{
+    int i;
+
+    for (i = 0; i < potential->max_predictors; i++)
+        tracked_free(MEMORY_TABLES, potential->predictors[i]);
+    tracked_free(MEMORY_TABLES, potential->predictors);
+    tracked_free(MEMORY_TABLES, potential->devpressure);
+    tracked_free(MEMORY_TABLES, potential->intercept);
+    tracked_free(MEMORY_TABLES, potential->file_coefficients);
+    KeyValueIntInt_free(potential->file_lines);
+    if (potential->incentive_transform_size > 0)
+        tracked_free(MEMORY_TABLES, potential->incentive_transform);
+}
+
+/* header of binary copy of patch library */
+struct PatchCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // patch library file the copy was created from
+    int64_t source_time;
+    int64_t source_size;
+    double discount_factor;
+    int32_t num_columns;
+    int32_t single_column;
+    int32_t max_patch_size;
+    // length of absolute path of the patch library stored after the header
+    int32_t source_path_length;
+    uint64_t num_sizes;
+    // size of arrays after the header in bytes
+    uint64_t data_size;
+};
+
+#define PATCH_CACHE_MAGIC "FUTPATCH"
+#define PATCH_CACHE_VERSION 2
+#define PATCH_CACHE_BYTE_ORDER 0x01020304
+
+/*!
+ * \brief Allocate arrays of patch library in a single block
+ *
+ * Column offsets go first, so that all arrays are aligned.
+ *
+ * \param patch_sizes patch sizes with num_columns set
+ * \param num_sizes number of patches in all columns
+ * \return size of the block in bytes
+ */
+static size_t allocate_patch_sizes(struct PatchSizes *patch_sizes, size_t num_sizes)
+{
+    size_t size;
+
+    size = (patch_sizes->num_columns + 1) * sizeof(size_t)
+            + (patch_sizes->num_columns + num_sizes) * sizeof(int);
+    patch_sizes->data = tracked_malloc(MEMORY_TABLES, size);
+    patch_sizes->column_offset = (size_t *) patch_sizes->data;
+    patch_sizes->column_ids = (int *) (patch_sizes->column_offset + patch_sizes->num_columns + 1);
+    patch_sizes->sizes = patch_sizes->column_ids + patch_sizes->num_columns;
+    return size;
+}
+
+static void get_patch_source_stamp(const char *filename, int64_t *time, int64_t *size,
+                                   char *path)
+{
+    struct stat info;
+
+    if (stat(filename, &info) != 0 || !realpath(filename, path))
+        G_fatal_error(_("Cannot open patch library file <%s>"), filename);
+    *time = info.st_mtime;
+    *size = info.st_size;
+}
+
+/*!
+ * \brief Load patch library from its binary copy
+ * \param patch_sizes patch sizes with filename and cache set
+ * \param discount_factor factor applied to patch sizes
+ * \return true if loaded, false if the copy doesn't exist or is outdated
+ */
+static bool load_patch_cache(struct PatchSizes *patch_sizes, double discount_factor)
+{
+    struct PatchCacheHeader header;
+    int64_t time, size;
+    char path[PATH_MAX], cached_path[PATH_MAX];
+    FILE *fp;
+    bool loaded;
+
+    fp = fopen(patch_sizes->cache, "rb");
+    if (!fp)
+        return false;
+    get_patch_source_stamp(patch_sizes->filename, &time, &size, path);
+    /* a different library with the same time and size is told apart by its path */
+    if (fread(&header, sizeof(header), 1, fp) != 1
+            || memcmp(header.magic, PATCH_CACHE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != PATCH_CACHE_VERSION
+            || header.byte_order != PATCH_CACHE_BYTE_ORDER
+            || header.source_time != time || header.source_size != size
+            || header.discount_factor != discount_factor
+            || header.source_path_length != (int32_t) strlen(path)
+            || fread(cached_path, header.source_path_length, 1, fp) != 1
+            || memcmp(cached_path, path, header.source_path_length) != 0) {
+        fclose(fp);
+        return false;
+    }
+    patch_sizes->num_columns = header.num_columns;
+    patch_sizes->single_column = header.single_column;
+    patch_sizes->max_patch_size = header.max_patch_size;
+    loaded = allocate_patch_sizes(patch_sizes, header.num_sizes) == header.data_size
+            && fread(patch_sizes->data, header.data_size, 1, fp) == 1;
+    fclose(fp);
+    if (!loaded) {
+        tracked_free(MEMORY_TABLES, patch_sizes->data);
+        return false;
+    }
+    G_verbose_message(_("Patch library loaded from <%s>"), patch_sizes->cache);
+    return true;
+}
+
+/*!
+ * \brief Save binary copy of patch library
+ *
+ * The copy is written under a temporary name and renamed,
+ * so concurrent runs never read an incomplete copy.
+ *
+ * \param patch_sizes patch sizes
+ * \param discount_factor factor applied to patch sizes
+ * \param data_size size of the arrays in bytes
+ */
+static void save_patch_cache(const struct PatchSizes *patch_sizes, double discount_factor,
+                             size_t data_size)
+{
+    struct PatchCacheHeader header;
+    char path[PATH_MAX];
+    char *temp_name;
+    FILE *fp;
+
+    G_zero(&header, sizeof(header));
+    memcpy(header.magic, PATCH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PATCH_CACHE_VERSION;
+    header.byte_order = PATCH_CACHE_BYTE_ORDER;
+    get_patch_source_stamp(patch_sizes->filename, &header.source_time, &header.source_size,
+                           path);
+    header.source_path_length = strlen(path);
+    header.discount_factor = discount_factor;
+    header.num_columns = patch_sizes->num_columns;
+    header.single_column = patch_sizes->single_column;
+    header.max_patch_size = patch_sizes->max_patch_size;
+    header.num_sizes = patch_sizes->column_offset[patch_sizes->num_columns];
+    header.data_size = data_size;
+
+    temp_name = G_malloc(strlen(patch_sizes->cache) + 32);
+    sprintf(temp_name, "%s.%d.tmp", patch_sizes->cache, (int) getpid());
+    fp = fopen(temp_name, "wb");
+    if (!fp || fwrite(&header, sizeof(header), 1, fp) != 1
+            || fwrite(path, header.source_path_length, 1, fp) != 1
+            || fwrite(patch_sizes->data, data_size, 1, fp) != 1
+            || fclose(fp) != 0 || rename(temp_name, patch_sizes->cache) != 0) {
+        unlink(temp_name);
+        G_warning(_("Unable to write patch library to <%s>"), patch_sizes->cache);
+    }
+    G_free(temp_name);
+}
+
+/*!
+ * \brief Collect patches from one line of patch library
+ * \param patch_sizes patch sizes with num_columns set
+ * \param tokens values in the line
+ * \param discount_factor factor applied to patch sizes
+ * \param[in,out] entries column and size of each patch
+ * \param[in,out] num_entries number of patches
+ * \param[in,out] max_entries number of allocated patches
+ */
+static void collect_patches(struct PatchSizes *patch_sizes, char **tokens,
+                            double discount_factor, int **entries,
+                            size_t *num_entries, size_t *max_entries)
+{
+    int i, ntokens;
+    int patch;
+
+    ntokens = G_number_of_tokens(tokens);
+    if (ntokens != patch_sizes->num_columns)
+        G_fatal_error(_("Patch library file <%s>"
+                        " has inconsistent number of columns"), patch_sizes->filename);
+    for (i = 0; i < ntokens; i++) {
+        if (strcmp(tokens[i], "") == 0)
+            continue;
+        patch = atoi(tokens[i]) * discount_factor;
+        if (patch <= 0)
+            continue;
+        if (patch > patch_sizes->max_patch_size)
+            patch_sizes->max_patch_size = patch;
+        if (*num_entries == *max_entries) {
+            *max_entries = *max_entries ? 2 * *max_entries : 1024;
+            *entries = G_realloc(*entries, 2 * *max_entries * sizeof(int));
+        }
+        (*entries)[2 * *num_entries] = i;
+        (*entries)[2 * *num_entries + 1] = patch;
+        (*num_entries)++;
+    }
+}
+
+/*!
+ * \brief Read patch library
+ *
+ * Patches of all columns are stored one after another with offsets
+ * of each column and discount factor already applied.
+ * The first line is considered a header with subregion ids when it has
+ * more than one column, a single column is used for all subregions.
+ * Each column gets at least one patch (of size 1).
+ * With cache set, the library is loaded from and saved to a binary copy.
+ *
+ * Subregions are not needed, so maximum patch size is known
+ * before the subregions are read. Columns are assigned to subregions
+ * by assign_patch_sizes().
+ *
+ * \param patch_sizes patch sizes with filename and cache set
+ * \param discount_factor factor applied to patch sizes
+ */
+void read_patch_sizes(struct PatchSizes *patch_sizes, double discount_factor)
 {
     FILE *fp;
     size_t buflen = 4000;
     char buf[buflen];
-    int patch;
-    char** tokens;
-    char** header_tokens;
-    int ntokens;
-    int i, j;
-    int region_id;
+    char **tokens;
+    int column;
+    int *column_ids;
     const char *td = "\"";
-    int num_regions;
-    bool found;
-    bool use_header;
-    int n_max_patches;
+    size_t n, num_entries, max_entries, num_sizes;
+    int *entries;
+    size_t *count;
+    size_t data_size;
+
+    patch_sizes->region_column = NULL;
+    if (patch_sizes->cache && load_patch_cache(patch_sizes, discount_factor))
+        return;
 
-    n_max_patches = 0;
-    patch_sizes->max_patch_size = 0;
     fp = fopen(patch_sizes->filename, "rb");
-    if (fp) {
-        /* just scan the file twice */
-        // scan in the header line
-        if (G_getl2(buf, buflen, fp) == 0)
-            G_fatal_error(_("Patch library file <%s>"
-                            " contains less than one line"), patch_sizes->filename);
-
-        header_tokens = G_tokenize2(buf, ",", td);
-        num_regions = G_number_of_tokens(header_tokens);
-        use_header = true;
-        patch_sizes->single_column = false;
-        if (num_regions == 1) {
-            use_header = false;
-            patch_sizes->single_column = true;
-            G_verbose_message(_("Only single column detected in patch library file <%s>."
-                                " It will be used for all subregions."), patch_sizes->filename);
-        }
-        /* Check there are enough columns for subregions in map */
-        if (num_regions != 1 && num_regions < region_map->nitems)
-            G_fatal_error(_("Patch library file <%s>"
-                            " has only %d columns but there are %d subregions"), patch_sizes->filename,
-                          num_regions, region_map->nitems);
-        /* Check all subregions in map have column in the file. */
-        if (use_header) {
-            for (i = 0; i < region_map->nitems; i++) {
-                found = false;
-                for (j = 0; j < num_regions; j++)
-                    if (region_map->key[i] == atoi(header_tokens[j]))
-                        found = true;
-                if (!found)
-                    G_fatal_error(_("Subregion id <%d> not found in header of patch file <%s>"),
-                                  region_map->key[i], patch_sizes->filename);
+    if (!fp)
+        G_fatal_error(_("Cannot open patch library file <%s>"), patch_sizes->filename);
+    if (G_getl2(buf, buflen, fp) == 0)
+        G_fatal_error(_("Patch library file <%s>"
+                        " contains less than one line"), patch_sizes->filename);
+    tokens = G_tokenize2(buf, ",", td);
+    patch_sizes->num_columns = G_number_of_tokens(tokens);
+    patch_sizes->single_column = patch_sizes->num_columns == 1;
+    column_ids = G_malloc(patch_sizes->num_columns * sizeof(int));
+    for (column = 0; column < patch_sizes->num_columns; column++)
+        column_ids[column] = atoi(tokens[column]);
+
+    /* collect column and size of each patch in one pass */
+    num_entries = max_entries = 0;
+    entries = NULL;
+    patch_sizes->max_patch_size = 1;
+    if (patch_sizes->single_column) {
+        G_verbose_message(_("Only single column detected in patch library file <%s>."
+                            " It will be used for all subregions."), patch_sizes->filename);
+        /* there is no header */
+        collect_patches(patch_sizes, tokens, discount_factor,
+                        &entries, &num_entries, &max_entries);
+    }
+    G_free_tokens(tokens);
+    while (G_getl2(buf, buflen, fp)) {
+        tokens = G_tokenize2(buf, ",", td);
+        collect_patches(patch_sizes, tokens, discount_factor,
+                        &entries, &num_entries, &max_entries);
+        G_free_tokens(tokens);
+    }
+    fclose(fp);
+
+    /* count patches in columns, ensure there is at least one patch in each */
+    count = G_calloc(patch_sizes->num_columns, sizeof(size_t));
+    for (n = 0; n < num_entries; n++)
+        count[entries[2 * n]]++;
+    num_sizes = num_entries;
+    for (column = 0; column < patch_sizes->num_columns; column++)
+        if (count[column] == 0)
+            num_sizes++;
+    data_size = allocate_patch_sizes(patch_sizes, num_sizes);
+    memcpy(patch_sizes->column_ids, column_ids, patch_sizes->num_columns * sizeof(int));
+    G_free(column_ids);
+    patch_sizes->column_offset[0] = 0;
+    for (column = 0; column < patch_sizes->num_columns; column++) {
+        patch_sizes->column_offset[column + 1] = patch_sizes->column_offset[column]
+                + (count[column] ? count[column] : 1);
+        if (count[column] == 0)
+            patch_sizes->sizes[patch_sizes->column_offset[column]] = 1;
+        count[column] = 0;
+    }
+    for (n = 0; n < num_entries; n++) {
+        column = entries[2 * n];
+        patch_sizes->sizes[patch_sizes->column_offset[column] + count[column]++] =
+                entries[2 * n + 1];
+    }
+    G_free(count);
+    G_free(entries);
+
+    if (patch_sizes->cache)
+        save_patch_cache(patch_sizes, discount_factor, data_size);
+}
+
+/*!
+ * \brief Assign columns of patch library to subregions
+ * \param patch_sizes patch sizes from read_patch_sizes()
+ * \param region_map subregion ids to indices
+ */
+void assign_patch_sizes(struct PatchSizes *patch_sizes, const struct KeyValueIntInt *region_map)
+{
+    int i, j;
+    bool found;
+
+    patch_sizes->region_column = tracked_calloc(MEMORY_TABLES, region_map->nitems, sizeof(int));
+    if (patch_sizes->single_column)
+        return;
+    /* Check there are enough columns for subregions in map */
+    if (patch_sizes->num_columns < region_map->nitems)
+        G_fatal_error(_("Patch library file <%s>"
+                        " has only %d columns but there are %d subregions"), patch_sizes->filename,
+                      patch_sizes->num_columns, region_map->nitems);
+    /* Check all subregions in map have column in the file. */
+    for (i = 0; i < region_map->nitems; i++) {
+        found = false;
+        for (j = 0; j < patch_sizes->num_columns; j++) {
+            if (region_map->key[i] == patch_sizes->column_ids[j]) {
+                patch_sizes->region_column[i] = j;
+                found = true;
+                break;
             }
         }
-        // initialize patch_info->patch_count to all zero
-        patch_sizes->patch_count = (int*) G_calloc(num_regions, sizeof(int));
-        /* add one for the header reading above */
-        if (!use_header)
-            n_max_patches++;
-        // take one line
-        while (G_getl2(buf, buflen, fp)) {
-            // process each column in row
-            tokens = G_tokenize2(buf, ",", td);
-            ntokens = G_number_of_tokens(tokens);
-            if (ntokens != num_regions)
-                G_fatal_error(_("Patch library file <%s>"
-                                " has inconsistent number of columns"), patch_sizes->filename);
-            n_max_patches++;
-        }
-        // in a 2D array
-        patch_sizes->patch_sizes = (int **) G_malloc(sizeof(int * ) * num_regions);
-        // malloc appropriate size for each area
-        for(i = 0; i < num_regions; i++) {
-            patch_sizes->patch_sizes[i] =
-                    (int *) G_malloc(n_max_patches * sizeof(int));
+        if (!found)
+            G_fatal_error(_("Subregion id <%d> not found in header of patch file <%s>"),
+                          region_map->key[i], patch_sizes->filename);
+    }
+}
+
+/*!
+ * \brief Free patch library
+ * \param patch_sizes patch sizes
+ */
+void free_patch_sizes(struct PatchSizes *patch_sizes)
+{
+    tracked_free(MEMORY_TABLES, patch_sizes->data);
+    if (patch_sizes->region_column)
+        tracked_free(MEMORY_TABLES, patch_sizes->region_column);
+}
+
+static int compare_years(const void *a, const void *b)
+{
+    const int *i1 = a;
+    const int *i2 = b;
+
+    return *i1 < *i2 ? -1 : (*i1 > *i2);
+}
+
+/*!
+ * \brief Read file with predictors changing during the simulation
+ *
+ * Each line except for the header contains year, predictor raster name
+ * as given in predictors and raster which replaces it from that year.
+ *
+ * \param changes changes with filename and separator set
+ * \param predictors names of predictor rasters
+ * \param num_predictors number of predictors
+ */
+void read_predictor_changes(struct PredictorChanges *changes, char **predictors,
+                            int num_predictors)
+{
+    FILE *fp;
+    size_t buflen = 4000;
+    char buf[buflen];
+    char **tokens;
+    int ntokens;
+    int i, max_changes;
+    int *order;
+    int *years, *indices;
+    char **rasters;
+    const char *td = "\"";
+
+    if ((fp = fopen(changes->filename, "r")) == NULL)
+        G_fatal_error(_("Cannot open predictor file <%s>"), changes->filename);
+    changes->count = max_changes = 0;
+    years = indices = NULL;
+    rasters = NULL;
+    /* first line is a header */
+    G_getl2(buf, buflen, fp);
+    while (G_getl2(buf, buflen, fp)) {
+        if (buf[0] == '\0')
+            continue;
+        tokens = G_tokenize2(buf, changes->separator, td);
+        ntokens = G_number_of_tokens(tokens);
+        if (ntokens == 0) {
+            G_free_tokens(tokens);
+            continue;
         }
-        /* read first line to skip header */
-        rewind(fp);
-        if (use_header)
-            G_getl2(buf, buflen, fp);
-
-        while (G_getl2(buf, buflen, fp)) {
-            tokens = G_tokenize2(buf, ",", td);
-            ntokens = G_number_of_tokens(tokens);
-            for (i = 0; i < ntokens; i++) {
-                if (strcmp(tokens[i], "") != 0 ) {
-                    patch = atoi(tokens[i]) * discount_factor;
-                    if (patch > 0) {
-                        if (patch_sizes->max_patch_size < patch)
-                            patch_sizes->max_patch_size = patch;
-                        if (use_header)
-                            KeyValueIntInt_find(region_map, atoi(header_tokens[i]), &region_id);
-                        else
-                            region_id = 0;
-                        patch_sizes->patch_sizes[region_id][patch_sizes->patch_count[region_id]] = patch;
-                        patch_sizes->patch_count[region_id]++;
-                    }
-                }
-            }
+        if (ntokens != 3)
+            G_fatal_error(_("Predictors: wrong number of columns in line: %s"), buf);
+        for (i = 0; i < 3; i++)
+            G_chop(tokens[i]);
+        if (changes->count == max_changes) {
+            max_changes = max_changes ? 2 * max_changes : 16;
+            years = G_realloc(years, max_changes * sizeof(int));
+            indices = G_realloc(indices, max_changes * sizeof(int));
+            rasters = G_realloc(rasters, max_changes * sizeof(char *));
         }
-        G_free_tokens(header_tokens);
+        years[changes->count] = atoi(tokens[0]);
+        for (i = 0; i < num_predictors; i++)
+            if (strcmp(predictors[i], tokens[1]) == 0)
+                break;
+        if (i == num_predictors)
+            G_fatal_error(_("Predictor <%s> in file <%s> is not one of predictors"),
+                          tokens[1], changes->filename);
+        indices[changes->count] = i;
+        if (G_find_raster2(tokens[2], "") == NULL)
+            G_fatal_error(_("Raster map <%s> not found"), tokens[2]);
+        rasters[changes->count] = G_store(tokens[2]);
+        changes->count++;
         G_free_tokens(tokens);
-        fclose(fp);
     }
-    /* ensure there is at least one patch in each region (of size 1) */
-    for (region_id = 0; region_id < num_regions; region_id++) {
-        if (patch_sizes->patch_count[region_id] == 0) {
-            patch_sizes->patch_sizes[region_id][0] = 1;
-            patch_sizes->patch_count[region_id]++;
+    fclose(fp);
+
+    /* sort by year keeping order of lines with the same year */
+    order = G_malloc(2 * (changes->count + 1) * sizeof(int));
+    for (i = 0; i < changes->count; i++) {
+        order[2 * i] = years[i];
+        order[2 * i + 1] = i;
+    }
+    qsort(order, changes->count, 2 * sizeof(int), compare_years);
+    changes->years = G_malloc((changes->count + 1) * sizeof(int));
+    changes->predictors = G_malloc((changes->count + 1) * sizeof(int));
+    changes->rasters = G_malloc((changes->count + 1) * sizeof(char *));
+    for (i = 0; i < changes->count; i++) {
+        changes->years[i] = years[order[2 * i + 1]];
+        changes->predictors[i] = indices[order[2 * i + 1]];
+        changes->rasters[i] = rasters[order[2 * i + 1]];
+    }
+    G_free(order);
+    G_free(years);
+    G_free(indices);
+    G_free(rasters);
+
+    changes->applied = 0;
+    changes->num_predictors = num_predictors;
+    changes->original = G_malloc(num_predictors * sizeof(char *));
+    changes->current = G_malloc(num_predictors * sizeof(char *));
+    changes->in_effect = G_malloc(num_predictors * sizeof(int));
+    for (i = 0; i < num_predictors; i++) {
+        changes->original[i] = changes->current[i] = predictors[i];
+        changes->in_effect[i] = -1;
+    }
+}
+
+/*!
+ * \brief Read or write a row of values of a predictor in effect
+ *
+ * \param fd temporary file with the values in effect
+ * \param buffer row of values
+ * \param row row
+ * \param write true to write the row, false to read it
+ */
+static void access_row_in_effect(int fd, FCELL *buffer, int row, bool write)
+{
+    size_t size;
+    off_t offset;
+    ssize_t ret;
+
+    size = Rast_window_cols() * sizeof(FCELL);
+    offset = (off_t) row * size;
+    ret = write ? pwrite(fd, buffer, size, offset) : pread(fd, buffer, size, offset);
+    if (ret != (ssize_t) size)
+        G_fatal_error(_("Cannot access temporary file with predictor values"));
+}
+
+/*!
+ * \brief Update aggregated predictors with predictors changing in given year
+ *
+ * All changes up to the year which were not applied yet are applied.
+ * Only the changed predictors are read, the difference between the new
+ * and the old value of the predictor multiplied by its coefficient
+ * is added to the aggregated value. Cells where the new raster is NULL
+ * keep the value in effect, i.e., the value from the last raster
+ * (or the original predictor) which is not NULL there.
+ * Values in effect of predictors which change again later are kept
+ * in a temporary file, so each change reads only the replacing raster
+ * (and the original predictor at its first change).
+ *
+ * \param changes predictor changes
+ * \param year year of the step
+ * \param segments segments
+ * \param potential Potential table
+ */
+void update_predictors(struct PredictorChanges *changes, int year,
+                       struct Segments *segments, const struct Potential *potential)
+{
+    int i, j, k, n, p;
+    int row, col, rows, cols;
+    int first;
+    int *predictors, *nfds;
+    int **fds;
+    char *filename;
+    FCELL **old_rows, **new_rows;
+    FCELL *raster_row;
+    FCELL *aggregated_row;
+    CELL *pot_row;
+    struct SegmentLayer *pot_layer;
+    bool changed;
+
+    if (changes->applied >= changes->count || changes->years[changes->applied] > year)
+        return;
+    first = changes->applied;
+    while (changes->applied < changes->count && changes->years[changes->applied] <= year)
+        changes->applied++;
+    predictors = G_malloc(changes->num_predictors * sizeof(int));
+    nfds = G_malloc(changes->num_predictors * sizeof(int));
+    fds = G_malloc(changes->num_predictors * sizeof(int *));
+    old_rows = G_malloc(changes->num_predictors * sizeof(FCELL *));
+    new_rows = G_malloc(changes->num_predictors * sizeof(FCELL *));
+    n = 0;
+    for (i = 0; i < changes->num_predictors; i++) {
+        /* replacing by a raster with the same name changes nothing */
+        changed = false;
+        for (j = first; j < changes->applied; j++)
+            if (changes->predictors[j] == i && strcmp(changes->rasters[j], changes->current[i]))
+                changed = true;
+        if (!changed)
+            continue;
+        /* the original predictor when there are no values in effect yet
+           and the rasters replacing it now */
+        predictors[n] = i;
+        nfds[n] = 1;
+        for (j = first; j < changes->applied; j++)
+            if (changes->predictors[j] == i)
+                nfds[n]++;
+        fds[n] = G_malloc(nfds[n] * sizeof(int));
+        fds[n][0] = changes->in_effect[i] < 0 ? Rast_open_old(changes->original[i], "") : -1;
+        for (j = first, k = 1; j < changes->applied; j++) {
+            if (changes->predictors[j] != i)
+                continue;
+            G_verbose_message(_("Replacing predictor <%s> by <%s>"),
+                              changes->current[i], changes->rasters[j]);
+            changes->current[i] = changes->rasters[j];
+            fds[n][k++] = Rast_open_old(changes->rasters[j], "");
+        }
+        /* values in effect are needed only when the predictor changes again */
+        for (j = changes->applied; j < changes->count; j++)
+            if (changes->predictors[j] == i)
+                break;
+        if (j < changes->count && changes->in_effect[i] < 0) {
+            filename = G_tempfile();
+            changes->in_effect[i] = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if (changes->in_effect[i] < 0)
+                G_fatal_error(_("Cannot create temporary file <%s>"), filename);
+            /* file is removed when closed */
+            unlink(filename);
+            G_free(filename);
+        }
+        old_rows[n] = Rast_allocate_f_buf();
+        new_rows[n] = Rast_allocate_f_buf();
+        n++;
+    }
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+    pot_layer = segments->use_potential_subregions ?
+                &segments->potential_subregions : &segments->subregions;
+    raster_row = Rast_allocate_f_buf();
+    aggregated_row = Rast_allocate_f_buf();
+    pot_row = Rast_allocate_c_buf();
+    for (row = 0; n && row < rows; row++) {
+        for (i = 0; i < n; i++) {
+            p = predictors[i];
+            if (fds[i][0] >= 0)
+                Rast_get_f_row(fds[i][0], old_rows[i], row);
+            else
+                access_row_in_effect(changes->in_effect[p], old_rows[i], row, false);
+            memcpy(new_rows[i], old_rows[i], cols * sizeof(FCELL));
+            for (k = 1; k < nfds[i]; k++) {
+                Rast_get_f_row(fds[i][k], raster_row, row);
+                for (col = 0; col < cols; col++)
+                    if (!Rast_is_f_null_value(&raster_row[col]))
+                        new_rows[i][col] = raster_row[col];
+            }
+            if (changes->in_effect[p] >= 0)
+                access_row_in_effect(changes->in_effect[p], new_rows[i], row, true);
         }
+        SegmentLayer_get_row(&segments->aggregated_predictor, aggregated_row, row);
+        SegmentLayer_get_row(pot_layer, pot_row, row);
+        for (col = 0; col < cols; col++) {
+            if (CellStates_get(&segments->states, row, col) == STATE_NULL)
+                continue;
+            for (i = 0; i < n; i++) {
+                /* the original predictor has data in all cells with data */
+                if (Rast_is_f_null_value(&old_rows[i][col])
+                        || new_rows[i][col] == old_rows[i][col])
+                    continue;
+                aggregated_row[col] += potential->predictors[predictors[i]][pot_row[col]]
+                        * (new_rows[i][col] - old_rows[i][col]);
+            }
+        }
+        SegmentLayer_put_row(&segments->aggregated_predictor, aggregated_row, row);
+    }
+    SegmentLayer_flush(&segments->aggregated_predictor);
+
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < nfds[i]; k++)
+            if (fds[i][k] >= 0)
+                Rast_close(fds[i][k]);
+        G_free(fds[i]);
+        G_free(old_rows[i]);
+        G_free(new_rows[i]);
     }
+    G_free(raster_row);
+    G_free(aggregated_row);
+    G_free(pot_row);
+    G_free(predictors);
+    G_free(nfds);
+    G_free(fds);
+    G_free(old_rows);
+    G_free(new_rows);
 }
 
+/*!
+ * \brief Free predictor changes
+ * \param changes predictor changes
+ */
+void free_predictor_changes(struct PredictorChanges *changes)
+{
+    int i;
 
+    for (i = 0; i < changes->count; i++)
+        G_free(changes->rasters[i]);
+    G_free(changes->years);
+    G_free(changes->predictors);
+    G_free(changes->rasters);
+    for (i = 0; i < changes->num_predictors; i++)
+        if (changes->in_effect[i] >= 0)
+            close(changes->in_effect[i]);
+    G_free(changes->original);
+    G_free(changes->current);
+    G_free(changes->in_effect);
+}
@@ -2,9 +2,11 @@
 #define FUTURES_INPUTS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <grass/segment.h>
 
 #include "keyvalue.h"
+#include "segments.h"
 
 
 struct Demand
@@ -24,7 +26,12 @@ struct Potential
     double *intercept;
     double *devpressure;
     int max_predictors;
+    // number of subregion indices with coefficients assigned
     int max_subregions;
+    // coefficients of each line of the file (intercept, development
+    // pressure and predictors) and subregion id to line
+    double *file_coefficients;
+    struct KeyValueIntInt *file_lines;
     float *incentive_transform;
     int incentive_transform_size;
     const char *separator;
@@ -33,36 +40,47 @@ struct Potential
 struct PatchSizes
 {
     const char *filename;
-    // array of patches
-    int **patch_sizes;
-    // array of number of patches per area
-    int *patch_count;
+    // binary copy of the library to load instead of the file (or NULL)
+    const char *cache;
+    // number of columns in the file
+    int num_columns;
+    // start of patches of each column in sizes (number of columns + 1 items)
+    size_t *column_offset;
+    // subregion id of each column
+    int *column_ids;
+    // sizes of patches of all columns one after another
+    int *sizes;
+    // single allocation of the arrays above
+    void *data;
+    // column of each subregion index
+    int *region_column;
     // maximum patch size
     int max_patch_size;
     // use single column for all regions
     bool single_column;
-
 };
 
-struct SegmentMemory
+/* predictor rasters which replace predictors from given year */
+struct PredictorChanges
 {
-    int rows;
-    int cols;
-    int in_memory;
+    const char *filename;
+    const char *separator;
+    int count;
+    // changes sorted by year
+    int *years;
+    int *predictors;
+    char **rasters;
+    // number of changes already applied
+    int applied;
+    // predictors as given and the last raster replacing each of them
+    int num_predictors;
+    const char **original;
+    const char **current;
+    // temporary files with values in effect of predictors changing again (-1 if none)
+    int *in_effect;
 };
 
-struct Segments
-{
-    SEGMENT developed;
-    SEGMENT subregions;
-    SEGMENT potential_subregions;
-    SEGMENT devpressure;
-    SEGMENT aggregated_predictor;
-    SEGMENT probability;
-    SEGMENT weight;
-    bool use_weight;
-    bool use_potential_subregions;
-};
+struct Snapshot;
 
 struct RasterInputs
 {
@@ -72,15 +90,34 @@ struct RasterInputs
     char **predictors;
     const char *devpressure;
     const char *weights;
+    // predictors changing during the simulation (or NULL)
+    const struct PredictorChanges *predictor_changes;
 };
 
 
-struct UndevelopedCell
+/* rows of inputs as they are stored in segments */
+struct InputRows
 {
+    const CELL *developed;
+    const CELL *subregions;
+    const CELL *potential_subregions;
+    const FCELL *devpressure;
+    const FCELL *weights;
+    const FCELL *aggregated_predictor;
+};
+
+/* number of bits of cell id stored in id_in_block */
+#define CELL_ID_BLOCK_BITS 16
+/* cell ids must be smaller than this */
+#define MAX_CELL_ID ((uint64_t) 1 << (32 + CELL_ID_BLOCK_BITS))
 
-    size_t id;
+struct UndevelopedCell
+{
     float probability;
     float cumulative_probability;
+    // 48-bit cell id split to fit into 16 bytes together with the rest
+    uint32_t id_block;
+    uint16_t id_in_block;
     bool tried;
 };
 
@@ -93,18 +130,58 @@ struct Undeveloped
 };
 
 
+/*!
+ * \brief Get id of an undeveloped cell
+ * \param cell undeveloped cell
+ * \return cell id (index in the computational region)
+ */
+static inline size_t UndevelopedCell_get_id(const struct UndevelopedCell *cell)
+{
+    return ((size_t) cell->id_block << CELL_ID_BLOCK_BITS) | cell->id_in_block;
+}
+
+/*!
+ * \brief Set id of an undeveloped cell
+ * \param cell undeveloped cell
+ * \param id cell id (smaller than MAX_CELL_ID)
+ */
+static inline void UndevelopedCell_set_id(struct UndevelopedCell *cell, size_t id)
+{
+    cell->id_block = id >> CELL_ID_BLOCK_BITS;
+    cell->id_in_block = id & (((size_t) 1 << CELL_ID_BLOCK_BITS) - 1);
+}
+
 void initialize_incentive(struct Potential *potential_info, float exponent);
+void read_valid_cells(struct RasterInputs inputs, const struct Segments *segments,
+                      struct ValidCells *valid, size_t *tile_order,
+                      struct KeyValueIntInt *region_map,
+                      struct KeyValueIntInt *reverse_region_map,
+                      struct KeyValueIntInt *potential_region_map);
+void read_valid_snapshot(const struct Snapshot *snapshot, struct ValidCells *valid,
+                         size_t *tile_order, struct KeyValueIntInt *region_map,
+                         struct KeyValueIntInt *reverse_region_map,
+                         struct KeyValueIntInt *potential_region_map);
 void read_input_rasters(struct RasterInputs inputs, struct Segments *segments,
-                        struct SegmentMemory segment_info, struct KeyValueIntInt *region_map,
+                        struct ValidCells *valid, struct KeyValueIntInt *region_map,
                         struct KeyValueIntInt *reverse_region_map,
-                        struct KeyValueIntInt *potential_region_map);
-void read_predictors(struct RasterInputs inputs, struct Segments *segments,
-                     const struct Potential *potential,
-                     const struct SegmentMemory segment_info);
+                        struct KeyValueIntInt *potential_region_map,
+                        struct Potential *potential, struct Snapshot *snapshot);
+void read_input_snapshot(struct RasterInputs inputs, struct Segments *segments,
+                         const struct Potential *potential, const struct Snapshot *snapshot);
+int get_max_steps(const char *filename);
+void get_raster_range(const char *name, double *min, double *max);
+int get_max_categories(const char *name);
 void read_demand_file(struct Demand *demandInfo, struct KeyValueIntInt *region_map);
-void read_potential_file(struct Potential *potentialInfo, struct KeyValueIntInt *region_map,
-                         int num_predictors);
-void read_patch_sizes(struct PatchSizes *patch_sizes, struct KeyValueIntInt *region_map,
-                      double discount_factor);
+void read_potential_file(struct Potential *potentialInfo, int num_predictors);
+void assign_potential(struct Potential *potential, const struct KeyValueIntInt *region_map);
+void free_potential(struct Potential *potential);
+void read_predictor_changes(struct PredictorChanges *changes, char **predictors,
+                            int num_predictors);
+void update_predictors(struct PredictorChanges *changes, int year,
+                       struct Segments *segments, const struct Potential *potential);
+void free_predictor_changes(struct PredictorChanges *changes);
+void read_patch_sizes(struct PatchSizes *patch_sizes, double discount_factor);
+void assign_patch_sizes(struct PatchSizes *patch_sizes, const struct KeyValueIntInt *region_map);
+void free_patch_sizes(struct PatchSizes *patch_sizes);
 
 #endif // FUTURES_INPUTS_H
@@ -19,6 +19,112 @@
 
 #include "keyvalue.h"
 
+/* keys are considered compact when they span at most this many times
+   the number of keys (plus a constant for small maps) */
+#define DIRECT_INDEX_FACTOR 4
+#define DIRECT_INDEX_MIN 64
+
+static unsigned int hash_key(int key, int nslots)
+{
+    unsigned int h = (unsigned int) key * 2654435769u;
+
+    return (h ^ (h >> 16)) & (nslots - 1);
+}
+
+/*!
+   \brief Find index of item with given key
+
+   \param kv KeyValueIntInt structure
+   \param key key to be found
+
+   \returns index of the item or -1 if not found
+ */
+static int find_index(const struct KeyValueIntInt *kv, int key)
+{
+    unsigned int slot;
+    long long offset;
+
+    if (kv->direct) {
+        offset = (long long) key - kv->min_key;
+        if (offset < 0 || offset >= kv->ndirect)
+            return -1;
+        return kv->direct[offset];
+    }
+    if (!kv->nslots)
+        return -1;
+    for (slot = hash_key(key, kv->nslots); kv->slots[slot] >= 0;
+         slot = (slot + 1) & (kv->nslots - 1))
+        if (kv->key[kv->slots[slot]] == key)
+            return kv->slots[slot];
+    return -1;
+}
+
+static void insert_slot(struct KeyValueIntInt *kv, int n)
+{
+    unsigned int slot;
+
+    for (slot = hash_key(kv->key[n], kv->nslots); kv->slots[slot] >= 0;
+         slot = (slot + 1) & (kv->nslots - 1))
+        ;
+    kv->slots[slot] = n;
+}
+
+/*!
+   \brief Add the last item to the direct index or the hash table
+
+   The hash table is kept at most half full. The direct index is rebuilt
+   when the new key is outside of its range and dropped when the keys
+   are not compact anymore, so that it is rebuilt only when the range
+   of keys grows.
+
+   \param kv KeyValueIntInt structure with the item already appended
+ */
+static void index_last_item(struct KeyValueIntInt *kv)
+{
+    int n, i;
+    int key = kv->key[kv->nitems - 1];
+    long long range, limit;
+
+    if (2 * kv->nitems > kv->nslots) {
+        kv->nslots = kv->nslots ? 2 * kv->nslots : 16;
+        kv->slots = (int *) G_realloc(kv->slots, kv->nslots * sizeof(int));
+        for (i = 0; i < kv->nslots; i++)
+            kv->slots[i] = -1;
+        for (n = 0; n < kv->nitems; n++)
+            insert_slot(kv, n);
+    }
+    else
+        insert_slot(kv, kv->nitems - 1);
+
+    if (kv->nitems == 1)
+        kv->min_key = kv->max_key = key;
+    if (kv->direct && key >= kv->min_key && (long long) key - kv->min_key < kv->ndirect) {
+        kv->direct[key - kv->min_key] = kv->nitems - 1;
+        if (key > kv->max_key)
+            kv->max_key = key;
+        return;
+    }
+    /* key outside of the direct index (or no direct index yet) */
+    if (key < kv->min_key)
+        kv->min_key = key;
+    if (key > kv->max_key)
+        kv->max_key = key;
+    G_free(kv->direct);
+    kv->direct = NULL;
+    kv->ndirect = 0;
+    range = (long long) kv->max_key - kv->min_key + 1;
+    limit = (long long) DIRECT_INDEX_FACTOR * kv->nitems + DIRECT_INDEX_MIN;
+    if (range > limit)
+        return;
+    /* leave space for more keys above the current ones */
+    kv->ndirect = 2 * range < limit ? 2 * range : limit;
+    kv->direct = (int *) G_malloc(kv->ndirect * sizeof(int));
+    for (i = 0; i < kv->ndirect; i++)
+        kv->direct[i] = -1;
+    for (n = 0; n < kv->nitems; n++)
+        kv->direct[kv->key[n] - kv->min_key] = n;
+}
+
 /*!
    \brief Allocate and initialize KeyValueIntInt structure
 
@@ -43,31 +149,30 @@ void KeyValueIntInt_set(struct KeyValueIntInt *kv, int key, int value)
 {
     int n;
 
-    for (n = 0; n < kv->nitems; n++)
-        if (key == kv->key[n])
-            break;
-
-    if (n == kv->nitems) {
-        if (n >= kv->nalloc) {
-            size_t size;
+    n = find_index(kv, key);
+    if (n >= 0) {
+        kv->value[n] = value;
+        return;
+    }
 
-            if (kv->nalloc <= 0)
-                kv->nalloc = 8;
-            else
-                kv->nalloc *= 2;
+    n = kv->nitems;
+    if (n >= kv->nalloc) {
+        size_t size;
 
-            size = kv->nalloc * sizeof(int);
-            kv->key = (int *) G_realloc(kv->key, size);
-            kv->value = (int *) G_realloc(kv->value, size);
-        }
+        if (kv->nalloc <= 0)
+            kv->nalloc = 8;
+        else
+            kv->nalloc *= 2;
 
-        kv->key[n] = key;
-        kv->value[n] = value;
-        kv->nitems++;
-        return;
+        size = kv->nalloc * sizeof(int);
+        kv->key = (int *) G_realloc(kv->key, size);
+        kv->value = (int *) G_realloc(kv->value, size);
     }
 
+    kv->key[n] = key;
     kv->value[n] = value;
+    kv->nitems++;
+    index_last_item(kv);
 }
 
 /*!
@@ -87,13 +192,11 @@ int KeyValueIntInt_find(const struct KeyValueIntInt *kv, int key, int *value)
     if (!kv)
         return FALSE;
 
-    for (n = 0; n < kv->nitems; n++)
-        if (key == kv->key[n]) {
-            *value = kv->value[n];
-            return TRUE;
-        }
-
-    return FALSE;
+    n = find_index(kv, key);
+    if (n < 0)
+        return FALSE;
+    *value = kv->value[n];
+    return TRUE;
 }
 
 /*!
@@ -108,6 +211,8 @@ void KeyValueIntInt_free(struct KeyValueIntInt *kv)
 
     G_free(kv->key);
     G_free(kv->value);
+    G_free(kv->slots);
+    G_free(kv->direct);
     kv->nitems = 0;                /* just for safe measure */
     kv->nalloc = 0;
     G_free(kv);
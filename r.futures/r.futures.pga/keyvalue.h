@@ -1,12 +1,24 @@
 #ifndef FUTURES_KEYVALUE_H
 #define FUTURES_KEYVALUE_H
 
+/* Items are kept in order of insertion in key and value,
+   lookup uses a direct index when the keys are in a compact range
+   and an open addressing hash table otherwise. */
 struct KeyValueIntInt
 {
     int nitems;
     int nalloc;
     int *key;
     int *value;
+    // hash table of item indices (-1 for empty slot), size is a power of 2
+    int nslots;
+    int *slots;
+    // smallest and largest key
+    int min_key;
+    int max_key;
+    // item indices (-1 for missing key) for keys from min_key, NULL if not compact
+    int ndirect;
+    int *direct;
 };
 
 struct KeyValueIntInt *KeyValueIntInt_create();
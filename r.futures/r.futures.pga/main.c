@@ -57,14 +57,23 @@
 #include <grass/segment.h>
 
 #include "keyvalue.h"
+#include "segments.h"
 #include "inputs.h"
 #include "output.h"
 #include "patch.h"
 #include "devpressure.h"
 #include "simulation.h"
+#include "memusage.h"
+#include "snapshot.h"
+#include "eventlog.h"
 
+/* tile sizes considered for segments */
+#define MIN_TILE_SIZE 64
+#define MAX_TILE_SIZE 256
+#define MIN_PATCH_TILE_SIZE 16
 
-struct Undeveloped *initialize_undeveloped(int num_subregions)
+
+struct Undeveloped *initialize_undeveloped(int num_subregions, size_t num_cells)
 {
     struct Undeveloped *undev = (struct Undeveloped *) G_malloc(sizeof(struct Undeveloped));
     undev->max_subregions = num_subregions;
@@ -72,46 +81,138 @@ struct Undeveloped *initialize_undeveloped(int num_subregions)
     undev->num = (size_t *) G_calloc(undev->max_subregions, sizeof(size_t));
     undev->cells = (struct UndevelopedCell **) G_malloc(undev->max_subregions * sizeof(struct UndevelopedCell *));
     for (int i = 0; i < undev->max_subregions; i++){
-        undev->max[i] = (Rast_window_rows() * Rast_window_cols()) / num_subregions;
-        undev->cells[i] = (struct UndevelopedCell *) G_malloc(undev->max[i] * sizeof(struct UndevelopedCell));
+        undev->max[i] = num_cells / num_subregions;
+        if (undev->max[i] == 0)
+            undev->max[i] = 1;
+        undev->cells[i] = (struct UndevelopedCell *) tracked_malloc(MEMORY_UNDEVELOPED,
+                                                                    undev->max[i] * sizeof(struct UndevelopedCell));
     }
     return undev;
 }
 
 
-static int manage_memory(struct SegmentMemory *memory, struct Segments *segments,
-                         float input_memory)
+/*!
+ * \brief Get expected number of tiles covered by a square window
+ *
+ * \param size side of the window in cells
+ * \param tile_rows number of rows in a tile
+ * \param tile_cols number of columns in a tile
+ * \return average number of tiles over all positions of the window
+ */
+static double get_tiles_per_window(int size, int tile_rows, int tile_cols)
+{
+    return (1 + (double) (size - 1) / tile_rows) * (1 + (double) (size - 1) / tile_cols);
+}
+
+/*!
+ * \brief Get memory left for tiles
+ *
+ * \param input_memory memory limit in GB
+ * \param ncells number of cells with data
+ * \param[out] other memory needed by other structures: memory already used,
+ * undeveloped cells and cell states with index
+ * \return memory in bytes left for tiles (negative when not sufficient)
+ */
+static double get_tiles_budget(float input_memory, size_t ncells, size_t *other)
+{
+    *other = get_total_memory_usage() + sizeof(struct UndevelopedCell) * ncells
+            + 3. / 8 * Rast_window_rows() * Rast_window_cols();
+    return 1e9 * input_memory - *other;
+}
+
+/*!
+ * \brief Choose tile size
+ *
+ * Tiles are enlarged to be at least as large as the development
+ * pressure neighborhood, so that updating pressure around a cell
+ * touches at most 4 tiles. When the memory is limited, tiles are made
+ * smaller if it allows to keep all tiles around the largest patch
+ * (with neighborhood) in memory twice over, since a smaller tile
+ * brings less unused cells into memory. Cells with data are not known yet,
+ * so all cells are assumed to have data.
+ *
+ * \param[out] memory tile size
+ * \param segments segments with storage types set
+ * \param input_memory memory limit in GB (negative for no limit)
+ * \param neighborhood development pressure neighborhood size
+ * \param max_patch_size maximum patch size
+ */
+static void manage_memory(struct SegmentMemory *memory, struct Segments *segments,
+                          float input_memory, int neighborhood, int max_patch_size)
+{
+    int cols, rows;
+    size_t other;
+    int stencil, window;
+    int tile, size_tile;
+    size_t size;
+    double budget;
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+
+    /* all layers with their storage types */
+    size = get_segments_cell_size(segments);
+    budget = get_tiles_budget(input_memory, (size_t) rows * cols, &other);
+
+    /* pressure stencil and the window pinned around a growing patch */
+    stencil = 2 * neighborhood + 1;
+    window = 2 * (neighborhood + (int) sqrt(max_patch_size) + 1) + 1;
+    tile = MIN_TILE_SIZE;
+    while (tile < stencil && tile < MAX_TILE_SIZE)
+        tile *= 2;
+    if (input_memory > 0 && budget < (double) size * rows * cols) {
+        for (size_tile = tile; size_tile >= MIN_PATCH_TILE_SIZE; size_tile /= 2) {
+            if (2 * get_tiles_per_window(window, size_tile, size_tile)
+                    * size_tile * size_tile * size <= budget) {
+                tile = size_tile;
+                break;
+            }
+        }
+    }
+    memory->rows = tile < rows ? tile : rows;
+    memory->cols = tile < cols ? tile : cols;
+    G_verbose_message(_("Tile size %dx%d, development pressure neighborhood spans "
+                        "%.1f tiles, largest patch with its neighborhood %.1f tiles"),
+                      memory->rows, memory->cols,
+                      get_tiles_per_window(stencil, memory->rows, memory->cols),
+                      get_tiles_per_window(window, memory->rows, memory->cols));
+}
+
+/*!
+ * \brief Choose number of tiles in memory
+ *
+ * Tiles get what remains from the memory limit after the other structures,
+ * which are sized by the number of cells with data.
+ *
+ * \param memory tile size
+ * \param segments segments with storage types and valid cells set
+ * \param input_memory memory limit in GB (negative for no limit)
+ * \param ncells number of cells with data (all cells when not known)
+ * \return number of tiles in memory
+ */
+static int get_tiles_in_memory(const struct SegmentMemory *memory,
+                               const struct Segments *segments,
+                               float input_memory, size_t ncells)
 {
     int nseg, nseg_total;
     int cols, rows;
-    int undev_size;
+    size_t other;
     size_t size;
     size_t estimate;
+    double budget;
 
-    memory->rows = 64;
-    memory->cols = 64;
     rows = Rast_window_rows();
     cols = Rast_window_cols();
 
-    undev_size = (sizeof(size_t) + sizeof(float) * 2 + sizeof(bool)) * rows * cols;
-    estimate = undev_size;
-
-    if (input_memory > 0 && undev_size > 1e9 * input_memory)
+    budget = get_tiles_budget(input_memory, ncells, &other);
+    if (input_memory > 0 && budget < 0)
         G_warning(_("Not sufficient memory, will attempt to use more "
-                    "than specified. Will need at least %d MB"), (int) (undev_size / 1.0e6));
-
-    /* developed, subregions */
-    size = sizeof(CELL) * 2;
-    /* predictors, devpressure, probability */
-    size += sizeof(FCELL) * 3;
-    if (segments->use_weight)
-        size += sizeof(FCELL);
-    if (segments->use_potential_subregions)
-        size += sizeof(CELL);
-    estimate = estimate + (size * rows * cols);
-    size *= memory->rows * memory->cols;
-
-    nseg = (1e9 * input_memory - undev_size) / size;
+                    "than specified. Will need at least %d MB"), (int) (other / 1.0e6));
+
+    size = get_segments_cell_size(segments);
+    estimate = other + size * get_segments_stored_cells(segments);
+
+    nseg = budget / (size * memory->rows * memory->cols);
     if (nseg <= 0)
         nseg = 1;
     nseg_total = (rows / memory->rows + (rows % memory->rows > 0)) *
@@ -135,21 +236,26 @@ int main(int argc, char **argv)
                 *developed, *subregions, *potentialSubregions, *predictors,
                 *devpressure, *nDevNeighbourhood, *devpressureApproach, *scalingFactor, *gamma,
                 *potentialFile, *numNeighbors, *discountFactor, *seedSearch,
-                *patchMean, *patchRange,
+                *patchMean, *patchRange, *storage, *flush, *floatStorage,
                 *incentivePower, *potentialWeight,
-                *demandFile, *separator, *patchFile, *numSteps, *output, *outputSeries, *seed, *memory;
+                *demandFile, *separator, *patchFile, *numSteps, *output, *outputSeries, *seed, *memory, *compressedMemory, *compression,
+                *snapshot, *patchCache, *predictorChanges, *eventLog, *geotiff;
 
     } opt;
 
     struct
     {
         struct Flag *generateSeed;
+        struct Flag *interleaved;
+        struct Flag *regionOrder;
+        struct Flag *quantizeWeight;
+        struct Flag *deferSeries;
+        struct Flag *reclassSeries;
     } flg;
 
     int i;
     int num_predictors;
     int num_steps;
-    int nseg;
     int region;
     int step;
     float memory;
@@ -163,14 +269,25 @@ int main(int argc, char **argv)
     struct Undeveloped *undev_cells;
     struct Demand demand_info;
     struct Potential potential_info;
+    struct PredictorChanges predictor_changes;
     struct SegmentMemory segment_info;
     struct PatchSizes patch_sizes;
     struct PatchInfo patch_info;
     struct DevPressure devpressure_info;
     struct Segments segments;
+    struct ValidCells valid_cells;
+    struct Snapshot snapshot;
+    struct SeriesWriter series_writer;
+    struct EventLog event_log;
+    uint64_t snapshot_key;
+    bool use_snapshot;
+    bool find_valid_cells;
     int *patch_overflow;
     char *name_step;
     bool overgrow;
+    bool flush_each_step;
+    enum layer_storage float_storage;
+    double devpressure_min, devpressure_max;
 
     G_gisinit(argv[0]);
 
@@ -215,6 +332,15 @@ int main(int argc, char **argv)
     opt.predictors->description = _("Listed in the same order as in the development potential table");
     opt.predictors->guisection = _("Potential");
 
+    opt.predictorChanges = G_define_standard_option(G_OPT_F_INPUT);
+    opt.predictorChanges->key = "predictor_changes";
+    opt.predictorChanges->required = NO;
+    opt.predictorChanges->label =
+            _("CSV file with predictors changing during the simulation");
+    opt.predictorChanges->description =
+            _("Each line contains year, predictor raster and raster replacing it from that year");
+    opt.predictorChanges->guisection = _("Potential");
+
     opt.devpressure = G_define_standard_option(G_OPT_R_INPUT);
     opt.devpressure->key = "development_pressure";
     opt.devpressure->required = YES;
@@ -270,6 +396,27 @@ int main(int argc, char **argv)
         _("Basename for raster maps of development generated after each step");
     opt.outputSeries->guisection = _("Output");
 
+    opt.eventLog = G_define_standard_option(G_OPT_F_OUTPUT);
+    opt.eventLog->key = "event_log";
+    opt.eventLog->required = NO;
+    opt.eventLog->label =
+            _("Name of output binary file with cells developed during the simulation");
+    opt.eventLog->description =
+            _("Maps can be recreated from the file with r.futures.events");
+    opt.eventLog->guisection = _("Output");
+
+    opt.geotiff = G_define_option();
+    opt.geotiff->key = "geotiff_directory";
+    opt.geotiff->type = TYPE_STRING;
+    opt.geotiff->key_desc = "name";
+    opt.geotiff->required = NO;
+    opt.geotiff->label =
+            _("Directory where output and output series are written also as GeoTIFF");
+    opt.geotiff->description =
+            _("Tiled compressed GeoTIFFs with overviews are written"
+              " together with the raster maps");
+    opt.geotiff->guisection = _("Output");
+
     opt.potentialFile = G_define_standard_option(G_OPT_F_INPUT);
     opt.potentialFile->key = "devpot_params";
     opt.potentialFile->required = YES;
@@ -300,6 +447,18 @@ int main(int argc, char **argv)
         _("File containing list of patch sizes to use");
     opt.patchFile->guisection = _("PGA");
 
+    opt.patchCache = G_define_option();
+    opt.patchCache->key = "patch_sizes_cache";
+    opt.patchCache->type = TYPE_STRING;
+    opt.patchCache->key_desc = "name";
+    opt.patchCache->required = NO;
+    opt.patchCache->label =
+            _("Binary file with patch library to reuse in later runs");
+    opt.patchCache->description =
+            _("Created when it doesn't exist or when the patch library file"
+              " or discount factor changed, otherwise loaded instead of the file");
+    opt.patchCache->guisection = _("PGA");
+
     opt.numNeighbors = G_define_option();
     opt.numNeighbors->key = "num_neighbors";
     opt.numNeighbors->type = TYPE_INTEGER;
@@ -398,12 +557,121 @@ int main(int argc, char **argv)
     opt.memory->required = NO;
     opt.memory->description = _("Memory in GB");
 
+    opt.storage = G_define_option();
+    opt.storage->key = "storage";
+    opt.storage->type = TYPE_STRING;
+    opt.storage->required = NO;
+    opt.storage->options = "segment,mmap,cache";
+    opt.storage->answer = "segment";
+    opt.storage->description = _("Storage of raster layers which don't fit into memory");
+    opt.storage->descriptions = _("segment;Tiles are cached by GRASS segment library;"
+                                  "mmap;Tiles are memory-mapped and cached by the operating system;"
+                                  "cache;Tiles are cached with priority for tiles around patches");
+
+    opt.compressedMemory = G_define_option();
+    opt.compressedMemory->key = "compressed_memory";
+    opt.compressedMemory->type = TYPE_DOUBLE;
+    opt.compressedMemory->required = NO;
+    opt.compressedMemory->label =
+            _("Memory in GB for compressed tiles which don't fit into memory");
+    opt.compressedMemory->description =
+            _("Tiles are written to disk only when compressed tiles don't fit"
+              " (only with storage=cache)");
+
+    opt.compression = G_define_option();
+    opt.compression->key = "compression";
+    opt.compression->type = TYPE_STRING;
+    opt.compression->required = NO;
+    opt.compression->options = "lz4,zstd,zlib";
+    opt.compression->answer = "lz4";
+    opt.compression->description = _("Compression of tiles kept in compressed memory");
+
+    opt.floatStorage = G_define_option();
+    opt.floatStorage->key = "float_storage";
+    opt.floatStorage->type = TYPE_STRING;
+    opt.floatStorage->required = NO;
+    opt.floatStorage->options = "float32,float16,bfloat16,int16";
+    opt.floatStorage->answer = "float32";
+    opt.floatStorage->description =
+            _("Storage of development pressure and aggregated predictors");
+    opt.floatStorage->descriptions =
+            _("float32;Full precision;"
+              "float16;Half precision (about 3 significant digits, values up to 65504);"
+              "bfloat16;Float with reduced precision (about 2 significant digits);"
+              "int16;Integers scaled to the range of values");
+
+    opt.snapshot = G_define_option();
+    opt.snapshot->key = "snapshot";
+    opt.snapshot->type = TYPE_STRING;
+    opt.snapshot->key_desc = "name";
+    opt.snapshot->required = NO;
+    opt.snapshot->label =
+            _("File with preprocessed inputs to reuse in later runs");
+    opt.snapshot->description =
+            _("Created when it doesn't exist or when inputs changed,"
+              " otherwise used instead of reading the input rasters");
+
+    opt.flush = G_define_option();
+    opt.flush->key = "flush";
+    opt.flush->type = TYPE_STRING;
+    opt.flush->required = NO;
+    opt.flush->options = "step,output";
+    opt.flush->answer = "step";
+    opt.flush->description = _("When to write all modified tiles to disk");
+    opt.flush->descriptions = _("step;After each step;"
+                                "output;Only before writing output maps");
+
+    flg.interleaved = G_define_flag();
+    flg.interleaved->key = 'i';
+    flg.interleaved->label =
+            _("Store input and computed raster layers interleaved in a single segment");
+    flg.interleaved->description =
+            _("Layers needed for a cell share one tile which reduces disk cache"
+              " misses when the memory is limited");
+
+    flg.regionOrder = G_define_flag();
+    flg.regionOrder->key = 'r';
+    flg.regionOrder->label =
+            _("Store tiles grouped by subregions");
+    flg.regionOrder->description =
+            _("Tiles of the same subregion are stored next to each other in temporary files"
+              " which reduces disk reads when the memory is limited (mmap and cache storage only)");
+
+    flg.quantizeWeight = G_define_flag();
+    flg.quantizeWeight->key = 'w';
+    flg.quantizeWeight->label =
+            _("Store potential weights with reduced precision");
+    flg.quantizeWeight->description =
+            _("Weights are stored in 1 byte per cell with precision about 0.008");
+    flg.quantizeWeight->guisection = _("Scenarios");
+
+    flg.deferSeries = G_define_flag();
+    flg.deferSeries->key = 'd';
+    flg.deferSeries->label =
+            _("Write output series at the end of the simulation");
+    flg.deferSeries->description =
+            _("All maps of the series are written in one pass over the final"
+              " developed areas instead of reading them after each step");
+    flg.deferSeries->guisection = _("Output");
+
+    flg.reclassSeries = G_define_flag();
+    flg.reclassSeries->key = 'c';
+    flg.reclassSeries->label =
+            _("Create output series as reclass of the output");
+    flg.reclassSeries->description =
+            _("Maps of the series are not written, they are derived from"
+              " the final output and take almost no disk space");
+    flg.reclassSeries->guisection = _("Output");
+
     // TODO: add mutually exclusive?
     // TODO: add flags or options to control values in series and final rasters
 
     // provided XOR generated
     G_option_exclusive(opt.seed, flg.generateSeed, NULL);
     G_option_required(opt.seed, flg.generateSeed, NULL);
+    G_option_exclusive(flg.deferSeries, flg.reclassSeries, NULL);
+    /* reclassified maps have no GeoTIFF copies */
+    G_option_exclusive(flg.reclassSeries, opt.geotiff, NULL);
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
@@ -445,7 +713,12 @@ int main(int argc, char **argv)
     patch_info.compactness_range = atof(opt.patchRange->answer);
     patch_info.num_neighbors = atoi(opt.numNeighbors->answer);
     patch_info.strategy = SKIP;
+    patch_info.events = NULL;
     
+    if ((uint64_t) Rast_window_rows() * Rast_window_cols() > MAX_CELL_ID)
+        G_fatal_error(_("Computational region has too many cells (maximum is %llu)"),
+                      (unsigned long long) MAX_CELL_ID);
+
     num_steps = 0;
     if (opt.numSteps->answer)
         num_steps = atoi(opt.numSteps->answer);
@@ -462,11 +735,59 @@ int main(int argc, char **argv)
     if (opt.potentialSubregions->answer) {
         segments.use_potential_subregions = true;
     }
+    segments.interleaved = flg.interleaved->answer ? true : false;
+    if (strcmp(opt.storage->answer, "mmap") == 0)
+        segments.backend = BACKEND_MMAP;
+    else if (strcmp(opt.storage->answer, "cache") == 0)
+        segments.backend = BACKEND_CACHE;
+    else
+        segments.backend = BACKEND_SEGMENT;
+    segments.compressor = 0;
+    segments.compressed_memory = 0;
+    segments.tile_order = NULL;
+    if (flg.regionOrder->answer && segments.backend == BACKEND_SEGMENT)
+        G_warning(_("Flag -%c is ignored with %s=%s"),
+                  flg.regionOrder->key, opt.storage->key, "segment");
+    if (opt.compressedMemory->answer) {
+        if (segments.backend != BACKEND_CACHE)
+            G_warning(_("Option %s is used only with %s=%s"),
+                      opt.compressedMemory->key, opt.storage->key, "cache");
+        segments.compressor = G_compressor_number(opt.compression->answer);
+        if (G_check_compressor(segments.compressor) != 1)
+            G_fatal_error(_("Compression %s is not available"), opt.compression->answer);
+        segments.compressed_memory = 1e9 * atof(opt.compressedMemory->answer);
+    }
+    if (strcmp(opt.floatStorage->answer, "float16") == 0)
+        float_storage = STORE_FLOAT16;
+    else if (strcmp(opt.floatStorage->answer, "bfloat16") == 0)
+        float_storage = STORE_BFLOAT16;
+    else if (strcmp(opt.floatStorage->answer, "int16") == 0)
+        float_storage = STORE_SCALED_INT16;
+    else
+        float_storage = STORE_NATIVE;
+    set_storage_types(&segments,
+                      num_steps ? num_steps : get_max_steps(opt.demandFile->answer),
+                      get_max_categories(opt.subregions->answer),
+                      opt.potentialSubregions->answer ?
+                          get_max_categories(opt.potentialSubregions->answer) : 0,
+                      flg.quantizeWeight->answer ? true : false, float_storage);
+    flush_each_step = strcmp(opt.flush->answer, "step") == 0;
     memory = -1;
     if (opt.memory->answer)
         memory = atof(opt.memory->answer);
-    nseg = manage_memory(&segment_info, &segments, memory);
-    segment_info.in_memory = nseg;
+    segments.memory_limit = memory > 0 ? 1e9 * memory : 0;
+    /* read Patch sizes file */
+    G_verbose_message("Reading patch size file...");
+    patch_sizes.filename = opt.patchFile->answer;
+    patch_sizes.cache = opt.patchCache->answer;
+    read_patch_sizes(&patch_sizes, discount_factor);
+    /* started before reading inputs to share as little memory as possible */
+    set_geotiff_directory(opt.geotiff->answer);
+    SeriesWriter_init(&series_writer);
+    if (opt.outputSeries->answer && !flg.deferSeries->answer && !flg.reclassSeries->answer)
+        SeriesWriter_start(&series_writer, Rast_window_rows(), Rast_window_cols());
+    manage_memory(&segment_info, &segments, memory, devpressure_info.neighborhood,
+                  patch_sizes.max_patch_size);
 
     potential_info.incentive_transform_size = 0;
     potential_info.incentive_transform = NULL;
@@ -480,35 +801,84 @@ int main(int argc, char **argv)
     raster_inputs.regions = opt.subregions->answer;
     raster_inputs.devpressure = opt.devpressure->answer;
     raster_inputs.predictors = opt.predictors->answers;
+    raster_inputs.weights = NULL;
+    raster_inputs.potential_regions = NULL;
+    raster_inputs.predictor_changes = NULL;
     if (opt.potentialWeight->answer)
         raster_inputs.weights = opt.potentialWeight->answer;
     if (opt.potentialSubregions->answer)
         raster_inputs.potential_regions = opt.potentialSubregions->answer;
+    if (opt.predictorChanges->answer) {
+        predictor_changes.filename = opt.predictorChanges->answer;
+        predictor_changes.separator = G_option_to_separator(opt.separator);
+        read_predictor_changes(&predictor_changes, opt.predictors->answers, num_predictors);
+        raster_inputs.predictor_changes = &predictor_changes;
+    }
 
     //    read Subregions layer
     region_map = KeyValueIntInt_create();
     reverse_region_map = KeyValueIntInt_create();
     potential_region_map = KeyValueIntInt_create();
-    G_verbose_message("Reading input rasters...");
-    read_input_rasters(raster_inputs, &segments, segment_info, region_map,
-                       reverse_region_map, potential_region_map);
-
-    /* create probability segment*/
-    if (Segment_open(&segments.probability, G_tempfile(), Rast_window_rows(),
-                     Rast_window_cols(), segment_info.rows, segment_info.cols,
-                     Rast_cell_size(FCELL_TYPE), segment_info.in_memory) != 1)
-        G_fatal_error(_("Cannot create temporary file with segments of a raster map"));
+    ValidCells_create(&valid_cells, Rast_window_rows(), Rast_window_cols(),
+                      segment_info.rows, segment_info.cols);
+    if (flg.regionOrder->answer && segments.backend != BACKEND_SEGMENT)
+        segments.tile_order = tracked_malloc(MEMORY_TILES, (size_t) valid_cells.ntile_rows
+                                             * valid_cells.ntile_cols * sizeof(size_t));
+    use_snapshot = false;
+    if (opt.snapshot->answer) {
+        snapshot_key = get_snapshot_key(raster_inputs, num_predictors, opt.potentialFile->answer,
+                                        G_option_to_separator(opt.separator));
+        use_snapshot = Snapshot_open(&snapshot, opt.snapshot->answer, snapshot_key, &segments);
+    }
+    if (use_snapshot) {
+        read_valid_snapshot(&snapshot, &valid_cells, segments.tile_order,
+                            region_map, reverse_region_map, potential_region_map);
+    }
+    /* tiles storing only cells with data or grouped by subregions and new snapshot
+       need cells with data before reading inputs, otherwise they are found while reading */
+    find_valid_cells = !use_snapshot
+            && (segments.backend != BACKEND_SEGMENT || opt.snapshot->answer);
+    if (find_valid_cells) {
+        G_verbose_message("Finding cells with data...");
+        read_valid_cells(raster_inputs, &segments, &valid_cells, segments.tile_order,
+                         region_map, reverse_region_map, potential_region_map);
+        if (opt.snapshot->answer)
+            Snapshot_create(&snapshot, opt.snapshot->answer, snapshot_key, &segments,
+                            &valid_cells, region_map, potential_region_map);
+    }
+    segments.valid = &valid_cells;
+    /* with segment storage, cells with data may be found only while reading inputs */
+    segment_info.in_memory = get_tiles_in_memory(
+                &segment_info, &segments, memory,
+                use_snapshot || find_valid_cells
+                    ? valid_cells.count : (size_t) Rast_window_rows() * Rast_window_cols());
+    open_segments(&segments, segment_info);
+    if (float_storage == STORE_SCALED_INT16) {
+        /* pressure only grows during the simulation */
+        get_raster_range(opt.devpressure->answer, &devpressure_min, &devpressure_max);
+        SegmentLayer_set_range(&segments.devpressure, devpressure_min,
+                               devpressure_max + get_max_devpressure_increase(&devpressure_info));
+    }
 
     /* read Potential file */
     G_verbose_message("Reading potential file...");
     potential_info.filename = opt.potentialFile->answer;
     potential_info.separator = G_option_to_separator(opt.separator);
-    read_potential_file(&potential_info, opt.potentialSubregions->answer ? potential_region_map : region_map, num_predictors);
+    read_potential_file(&potential_info, num_predictors);
 
-    /* read in predictors and aggregate to save memory */
-    G_verbose_message("Reading predictors...");
-    read_predictors(raster_inputs, &segments, &potential_info,
-                    segment_info);
+    /* read inputs and predictors, aggregate predictors to save memory */
+    G_verbose_message("Reading input rasters...");
+    if (use_snapshot) {
+        assign_potential(&potential_info, opt.potentialSubregions->answer ?
+                                              potential_region_map : region_map);
+        read_input_snapshot(raster_inputs, &segments, &potential_info, &snapshot);
+    }
+    else
+        read_input_rasters(raster_inputs, &segments, find_valid_cells ? NULL : &valid_cells,
+                           region_map, reverse_region_map, potential_region_map,
+                           &potential_info, opt.snapshot->answer ? &snapshot : NULL);
+    if (opt.snapshot->answer)
+        Snapshot_close(&snapshot);
 
     /* read Demand file */
     G_verbose_message("Reading demand file...");
@@ -518,17 +888,23 @@ int main(int argc, char **argv)
     if (num_steps == 0)
         num_steps = demand_info.max_steps;
 
-    /* read Patch sizes file */
-    G_verbose_message("Reading patch size file...");
-    patch_sizes.filename = opt.patchFile->answer;
-    read_patch_sizes(&patch_sizes, region_map, discount_factor);
+    assign_patch_sizes(&patch_sizes, region_map);
 
-    undev_cells = initialize_undeveloped(region_map->nitems);
+    undev_cells = initialize_undeveloped(region_map->nitems, valid_cells.count);
     patch_overflow = G_calloc(region_map->nitems, sizeof(int));
+    limit_segments_memory(&segments);
     /* here do the modeling */
     overgrow = true;
+    if (opt.eventLog->answer) {
+        EventLog_open(&event_log, opt.eventLog->answer, reverse_region_map,
+                      &segments.states);
+        patch_info.events = &event_log;
+    }
     G_verbose_message("Starting simulation...");
     for (step = 0; step < num_steps; step++) {
+        if (opt.predictorChanges->answer)
+            update_predictors(&predictor_changes, demand_info.years[step],
+                              &segments, &potential_info);
         recompute_probabilities(undev_cells, &segments, &potential_info);
         if (step == num_steps - 1)
             overgrow = false;
@@ -537,62 +913,63 @@ int main(int argc, char **argv)
                          &patch_sizes, &patch_info, &devpressure_info, patch_overflow,
                          step, region, reverse_region_map, overgrow);
         }
+        if (flush_each_step)
+            flush_segments(&segments);
         /* export developed for that step */
-        if (opt.outputSeries->answer) {
+        if (opt.outputSeries->answer && !flg.deferSeries->answer
+                && !flg.reclassSeries->answer) {
             name_step = name_for_step(opt.outputSeries->answer, step, num_steps);
-            output_developed_step(&segments.developed, name_step,
-                                  demand_info.years[step], -1, num_steps, true, true);
+            SeriesWriter_write(&series_writer, &segments.states, name_step,
+                               demand_info.years[step], num_steps);
         }
     }
+    SeriesWriter_finish(&series_writer);
+    if (opt.eventLog->answer)
+        EventLog_close(&event_log);
+    if (opt.outputSeries->answer && flg.deferSeries->answer)
+        output_developed_series(&segments.developed, opt.outputSeries->answer,
+                                demand_info.years, num_steps);
 
     /* write */
     output_developed_step(&segments.developed, opt.output->answer,
                           demand_info.years[0], demand_info.years[step-1],
                           num_steps, false, false);
+    if (opt.outputSeries->answer && flg.reclassSeries->answer)
+        output_series_reclass(opt.output->answer, opt.outputSeries->answer,
+                              demand_info.years, num_steps);
 
     /* close segments and free memory */
-    Segment_close(&segments.developed);
-    Segment_close(&segments.subregions);
-    Segment_close(&segments.devpressure);
-    Segment_close(&segments.probability);
-    Segment_close(&segments.aggregated_predictor);
-    if (opt.potentialWeight->answer) {
-        Segment_close(&segments.weight);
-    }
-    if (opt.potentialSubregions->answer)
-        Segment_close(&segments.potential_subregions);
+    close_segments(&segments);
+    ValidCells_free(&valid_cells);
+    if (segments.tile_order)
+        tracked_free(MEMORY_TILES, segments.tile_order);
 
     KeyValueIntInt_free(region_map);
     KeyValueIntInt_free(reverse_region_map);
     if (demand_info.table) {
         for (int i = 0; i < demand_info.max_subregions; i++)
-            G_free(demand_info.table[i]);
-        G_free(demand_info.table);
-        G_free(demand_info.years);
-    }
-    if (potential_info.predictors) {
-        for (int i = 0; i < potential_info.max_predictors; i++)
-            G_free(potential_info.predictors[i]);
-        G_free(potential_info.predictors);
-        G_free(potential_info.devpressure);
-        G_free(potential_info.intercept);
+            tracked_free(MEMORY_TABLES, demand_info.table[i]);
+        tracked_free(MEMORY_TABLES, demand_info.table);
+        tracked_free(MEMORY_TABLES, demand_info.years);
     }
+    free_potential(&potential_info);
     for (int i = 0; i < devpressure_info.neighborhood * 2 + 1; i++)
-        G_free(devpressure_info.matrix[i]);
-    G_free(devpressure_info.matrix);
-    if (potential_info.incentive_transform_size > 0)
-        G_free(potential_info.incentive_transform);
+        tracked_free(MEMORY_DEVPRESSURE, devpressure_info.matrix[i]);
+    tracked_free(MEMORY_DEVPRESSURE, devpressure_info.matrix);
     if (undev_cells) {
         G_free(undev_cells->num);
         G_free(undev_cells->max);
         for (int i = 0; i < undev_cells->max_subregions; i++)
-            G_free(undev_cells->cells[i]);
+            tracked_free(MEMORY_UNDEVELOPED, undev_cells->cells[i]);
         G_free(undev_cells->cells);
         G_free(undev_cells);
     }
 
-    G_free(patch_sizes.patch_sizes);
+    free_patch_sizes(&patch_sizes);
+    if (opt.predictorChanges->answer)
+        free_predictor_changes(&predictor_changes);
     G_free(patch_overflow);
+    report_memory_usage();
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,166 @@
+/*!
+   \file memusage.c
+
+   \brief Accounting of memory used by parts of the simulation
+
+   Large structures are allocated through these functions, so the memory
+   used by each part of the simulation is known while it runs and
+   can be compared to the memory limit, and its peak can be reported.
+   Memory allocated elsewhere (e.g., by the GRASS segment library)
+   is added explicitly.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <string.h>
+
+#include <grass/gis.h>
+#include <grass/glocale.h>
+
+#include "memusage.h"
+
+/* size is stored before the memory, header keeps the alignment */
+#define HEADER_SIZE 16
+
+static const char *use_names[MEMORY_USES] = {
+    "tile cache", "compressed tiles", "cell states and index",
+    "undeveloped cells", "patch candidates", "development pressure",
+    "tables"
+};
+
+static size_t usage[MEMORY_USES];
+static size_t peak[MEMORY_USES];
+static size_t total;
+static size_t peak_total;
+
+/*!
+ * \brief Account memory allocated elsewhere
+ * \param use part of the simulation
+ * \param size size in bytes
+ */
+void track_memory(enum memory_use use, size_t size)
+{
+    usage[use] += size;
+    if (usage[use] > peak[use])
+        peak[use] = usage[use];
+    total += size;
+    if (total > peak_total)
+        peak_total = total;
+}
+
+/*!
+ * \brief Remove memory allocated elsewhere from the accounting
+ * \param use part of the simulation
+ * \param size size in bytes
+ */
+void untrack_memory(enum memory_use use, size_t size)
+{
+    usage[use] -= size;
+    total -= size;
+}
+
+/*!
+ * \brief Allocate accounted memory
+ * \param use part of the simulation
+ * \param size size in bytes
+ * \return pointer to the memory
+ */
+void *tracked_malloc(enum memory_use use, size_t size)
+{
+    char *block = G_malloc(size + HEADER_SIZE);
+
+    *(size_t *) block = size;
+    track_memory(use, size);
+    return block + HEADER_SIZE;
+}
+
+/*!
+ * \brief Allocate accounted memory filled with zeros
+ * \param use part of the simulation
+ * \param n number of items
+ * \param size size of item in bytes
+ * \return pointer to the memory
+ */
+void *tracked_calloc(enum memory_use use, size_t n, size_t size)
+{
+    void *ptr = tracked_malloc(use, n * size);
+
+    memset(ptr, 0, n * size);
+    return ptr;
+}
+
+/*!
+ * \brief Change size of accounted memory
+ * \param use part of the simulation
+ * \param ptr pointer from tracked allocation or NULL
+ * \param size new size in bytes
+ * \return pointer to the memory
+ */
+void *tracked_realloc(enum memory_use use, void *ptr, size_t size)
+{
+    char *block;
+
+    if (!ptr)
+        return tracked_malloc(use, size);
+    block = (char *) ptr - HEADER_SIZE;
+    untrack_memory(use, *(size_t *) block);
+    block = G_realloc(block, size + HEADER_SIZE);
+    *(size_t *) block = size;
+    track_memory(use, size);
+    return block + HEADER_SIZE;
+}
+
+/*!
+ * \brief Free accounted memory
+ * \param use part of the simulation
+ * \param ptr pointer from tracked allocation or NULL
+ */
+void tracked_free(enum memory_use use, void *ptr)
+{
+    char *block;
+
+    if (!ptr)
+        return;
+    block = (char *) ptr - HEADER_SIZE;
+    untrack_memory(use, *(size_t *) block);
+    G_free(block);
+}
+
+/*!
+ * \brief Get memory currently used by a part of the simulation
+ * \param use part of the simulation
+ * \return size in bytes
+ */
+size_t get_memory_usage(enum memory_use use)
+{
+    return usage[use];
+}
+
+/*!
+ * \brief Get memory currently used by all parts of the simulation
+ * \return size in bytes
+ */
+size_t get_total_memory_usage(void)
+{
+    return total;
+}
+
+/*!
+ * \brief Report peak memory usage of all parts of the simulation
+ */
+void report_memory_usage(void)
+{
+    int i;
+
+    for (i = 0; i < MEMORY_USES; i++)
+        if (peak[i])
+            G_verbose_message(_("Peak memory used by %s: %.1f MB"),
+                              use_names[i], peak[i] / 1e6);
+    G_verbose_message(_("Peak memory used in total: %.1f MB"), peak_total / 1e6);
+}
@@ -0,0 +1,21 @@
+#ifndef FUTURES_MEMUSAGE_H
+#define FUTURES_MEMUSAGE_H
+
+#include <stdlib.h>
+
+/* parts of the simulation with memory accounted separately */
+enum memory_use {MEMORY_TILES, MEMORY_COMPRESSED_TILES, MEMORY_CELL_INDEX,
+                 MEMORY_UNDEVELOPED, MEMORY_CANDIDATES, MEMORY_DEVPRESSURE,
+                 MEMORY_TABLES, MEMORY_USES};
+
+void *tracked_malloc(enum memory_use use, size_t size);
+void *tracked_calloc(enum memory_use use, size_t n, size_t size);
+void *tracked_realloc(enum memory_use use, void *ptr, size_t size);
+void tracked_free(enum memory_use use, void *ptr);
+void track_memory(enum memory_use use, size_t size);
+void untrack_memory(enum memory_use use, size_t size);
+size_t get_memory_usage(enum memory_use use);
+size_t get_total_memory_usage(void);
+void report_memory_usage(void);
+
+#endif // FUTURES_MEMUSAGE_H
@@ -15,14 +15,50 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <grass/config.h>
+#ifdef HAVE_GDAL
+#include <gdal.h>
+#include <cpl_string.h>
+#endif
 
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
 #include <grass/segment.h>
 
+#include "cellstates.h"
+#include "segments.h"
+#include "memusage.h"
 #include "output.h"
 
+/* size of tiles of GeoTIFF outputs */
+#define GEOTIFF_TILE_SIZE 256
+
+/* directory for GeoTIFF copies of outputs (NULL if not written) */
+static const char *geotiff_directory = NULL;
+
+/* raster map and its GeoTIFF copy written row by row */
+struct OutputMap
+{
+    const char *name;
+    int fd;
+    int row;
+#ifdef HAVE_GDAL
+    GDALDatasetH dataset;
+    GDALRasterBandH band;
+    int nodata;
+    GInt32 *buffer;
+#endif
+};
+
 
 static void create_timestamp(int year, struct TimeStamp* timestamp)
 {
@@ -49,72 +85,173 @@ static void create_timestamp_range(int year_from, int year_to,
 }
 
 /*!
- * \brief Create an output name from basename and step
+ * \brief Set directory where outputs are written also as GeoTIFF
+ * \param directory directory (NULL for no GeoTIFF outputs)
+ */
+void set_geotiff_directory(const char *directory)
+{
+#ifndef HAVE_GDAL
+    if (directory)
+        G_fatal_error(_("GeoTIFF output requires GRASS GIS compiled with GDAL"));
+#endif
+    geotiff_directory = directory;
+}
+
+#ifdef HAVE_GDAL
+/*!
+ * \brief Create tiled GeoTIFF for an output map
  *
- * \param basename basename specified by user
- * \param step step of simulation (0 is first step)
- * \param nsteps total number of steps to add zero padding
- * \return output name
+ * Tiles are compressed by GDAL in parallel on all available cores.
+ *
+ * \param map output map with name set
+ * \param binary values are only 1 and NULL (stored as byte)
  */
-char *name_for_step(const char *basename, const int step, const int nsteps)
+static void create_geotiff(struct OutputMap *map, bool binary)
 {
-    int digits;
-    digits = log10(nsteps) + 1;
+    GDALDriverH driver;
+    char **options;
+    char *path;
+    char *wkt;
+    char tile_size[16];
+    double transform[6];
+    struct Cell_head window;
 
-    return G_generate_basename(basename, step + 1, digits, 0);
+    GDALAllRegister();
+    driver = GDALGetDriverByName("GTiff");
+    if (!driver)
+        G_fatal_error(_("GDAL driver GTiff not available"));
+    sprintf(tile_size, "%d", GEOTIFF_TILE_SIZE);
+    options = NULL;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", tile_size);
+    options = CSLSetNameValue(options, "BLOCKYSIZE", tile_size);
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    options = CSLSetNameValue(options, "NUM_THREADS", "ALL_CPUS");
+    options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+    G_asprintf(&path, "%s/%s.tif", geotiff_directory, map->name);
+    G_get_window(&window);
+    map->dataset = GDALCreate(driver, path, window.cols, window.rows, 1,
+                              binary ? GDT_Byte : GDT_Int16, options);
+    CSLDestroy(options);
+    if (!map->dataset)
+        G_fatal_error(_("Cannot create GeoTIFF <%s>"), path);
+    G_free(path);
+
+    transform[0] = window.west;
+    transform[1] = window.ew_res;
+    transform[2] = 0;
+    transform[3] = window.north;
+    transform[4] = 0;
+    transform[5] = -window.ns_res;
+    GDALSetGeoTransform(map->dataset, transform);
+    wkt = G_get_projwkt();
+    if (wkt) {
+        GDALSetProjection(map->dataset, wkt);
+        G_free(wkt);
+    }
+    map->band = GDALGetRasterBand(map->dataset, 1);
+    /* binary maps have only 1, step is never negative except -1 */
+    map->nodata = binary ? 0 : -32768;
+    GDALSetRasterNoDataValue(map->band, map->nodata);
+    map->buffer = G_malloc(window.cols * sizeof(GInt32));
 }
 
+/*!
+ * \brief Build internal overviews and close GeoTIFF of an output map
+ * \param map output map
+ */
+static void close_geotiff(struct OutputMap *map)
+{
+    int levels[32];
+    int num_levels;
+    int size;
+
+    size = GDALGetRasterXSize(map->dataset) > GDALGetRasterYSize(map->dataset) ?
+           GDALGetRasterXSize(map->dataset) : GDALGetRasterYSize(map->dataset);
+    for (num_levels = 0; num_levels < 32 && size >> (num_levels + 1) >= GEOTIFF_TILE_SIZE;
+         num_levels++)
+        levels[num_levels] = 2 << num_levels;
+    if (num_levels && GDALBuildOverviews(map->dataset, "NEAREST", num_levels, levels,
+                                         0, NULL, NULL, NULL) != CE_None)
+        G_fatal_error(_("Failed to build overviews of GeoTIFF for <%s>"), map->name);
+    GDALClose(map->dataset);
+    G_free(map->buffer);
+}
+#endif
 
 /*!
- * \brief Write current state of developed areas.
- * \param developed_segment segment of developed cells
- * \param name name for output map
+ * \brief Open output map and its GeoTIFF copy if requested
+ * \param map output map
+ * \param name name of the map
+ * \param binary values are only 1 and NULL
+ */
+static void OutputMap_open(struct OutputMap *map, const char *name, bool binary)
+{
+    map->name = name;
+    map->row = 0;
+    map->fd = Rast_open_new(name, CELL_TYPE);
+#ifdef HAVE_GDAL
+    map->dataset = NULL;
+    if (geotiff_directory)
+        create_geotiff(map, binary);
+#else
+    (void) binary;
+#endif
+}
+
+/*!
+ * \brief Write next row of output map
+ * \param map output map
+ * \param row values of the row
+ */
+static void OutputMap_put_row(struct OutputMap *map, const CELL *row)
+{
+    Rast_put_c_row(map->fd, row);
+#ifdef HAVE_GDAL
+    if (map->dataset) {
+        int col, cols;
+
+        cols = Rast_window_cols();
+        for (col = 0; col < cols; col++)
+            map->buffer[col] = Rast_is_c_null_value(&row[col]) ? map->nodata : row[col];
+        if (GDALRasterIO(map->band, GF_Write, 0, map->row, cols, 1, map->buffer,
+                         cols, 1, GDT_Int32, 0, 0) != CE_None)
+            G_fatal_error(_("Failed to write GeoTIFF for <%s>"), map->name);
+    }
+#endif
+    map->row++;
+}
+
+/*!
+ * \brief Close output map and its GeoTIFF copy
+ * \param map output map
+ */
+static void OutputMap_close(struct OutputMap *map)
+{
+    Rast_close(map->fd);
+#ifdef HAVE_GDAL
+    if (map->dataset)
+        close_geotiff(map);
+#endif
+}
+
+/*!
+ * \brief Write color table, history and timestamp of an output
+ * \param name name of output map
  * \param year_from year to put as timestamp
  * \param year_to if > 0 it is end year of timestamp interval
  * \param nsteps total number of steps (needed for color table)
- * \param undeveloped_as_null Represent undeveloped areas as NULLs instead of -1
- * \param developed_as_one Represent all developed areas as 1 instead of number
-        representing the step when it was developed
+ * \param undeveloped_as_null undeveloped areas are NULLs instead of -1
+ * \param developed_as_one developed areas are 1 instead of step
  */
-void output_developed_step(SEGMENT *developed_segment, const char *name,
-                           int year_from, int year_to, int nsteps, bool undeveloped_as_null, bool developed_as_one)
+static void write_metadata(const char *name, int year_from, int year_to, int nsteps,
+                           bool undeveloped_as_null, bool developed_as_one)
 {
-    int out_fd;
-    int row, col, rows, cols;
-    CELL *out_row;
-    CELL developed;
     CELL val1, val2;
     struct Colors colors;
     const char *mapset;
     struct History hist;
 
-    rows = Rast_window_rows();
-    cols = Rast_window_cols();
-
-    Segment_flush(developed_segment);
-    out_fd = Rast_open_new(name, CELL_TYPE);
-    out_row = Rast_allocate_c_buf();
-
-    for (row = 0; row < rows; row++) {
-        Rast_set_c_null_value(out_row, cols);
-        for (col = 0; col < cols; col++) {
-            Segment_get(developed_segment, (void *)&developed, row, col);
-            if (Rast_is_c_null_value(&developed)) {
-                continue;
-            }
-            /* this handles undeveloped cells */
-            if (undeveloped_as_null && developed == -1)
-                continue;
-            /* this handles developed cells */
-            if (developed_as_one)
-                developed = 1;
-            out_row[col] = developed;
-        }
-        Rast_put_c_row(out_fd, out_row);
-    }
-    G_free(out_row);
-    Rast_close(out_fd);
-
     Rast_init_colors(&colors);
     // TODO: the map max is 36 for 36 steps, it is correct?
 
@@ -141,7 +278,8 @@ void output_developed_step(SEGMENT *developed_segment, const char *name,
                               &colors);
     }
 
-    mapset = G_find_file2("cell", name, "");
+    /* reclassed maps have only cellhd */
+    mapset = G_find_raster2(name, "");
 
     if (mapset == NULL)
         G_fatal_error(_("Raster map <%s> not found"), name);
@@ -163,3 +301,431 @@ void output_developed_step(SEGMENT *developed_segment, const char *name,
     G_message(_("Raster map <%s> created"), name);
 
 }
+
+/*!
+ * \brief Create an output name from basename and step
+ *
+ * \param basename basename specified by user
+ * \param step step of simulation (0 is first step)
+ * \param nsteps total number of steps to add zero padding
+ * \return output name
+ */
+char *name_for_step(const char *basename, const int step, const int nsteps)
+{
+    int digits;
+    digits = log10(nsteps) + 1;
+
+    return G_generate_basename(basename, step + 1, digits, 0);
+}
+
+
+/*!
+ * \brief Write current state of developed areas.
+ * \param developed_segment layer of developed cells
+ * \param name name for output map
+ * \param year_from year to put as timestamp
+ * \param year_to if > 0 it is end year of timestamp interval
+ * \param nsteps total number of steps (needed for color table)
+ * \param undeveloped_as_null Represent undeveloped areas as NULLs instead of -1
+ * \param developed_as_one Represent all developed areas as 1 instead of number
+        representing the step when it was developed
+ */
+void output_developed_step(struct SegmentLayer *developed_segment, const char *name,
+                           int year_from, int year_to, int nsteps, bool undeveloped_as_null, bool developed_as_one)
+{
+    struct OutputMap out_map;
+    int row, col, rows, cols;
+    CELL *out_row;
+    CELL developed;
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+
+    SegmentLayer_flush(developed_segment);
+    SegmentLayer_set_scan(developed_segment, true);
+    OutputMap_open(&out_map, name, undeveloped_as_null && developed_as_one);
+    out_row = Rast_allocate_c_buf();
+
+    for (row = 0; row < rows; row++) {
+        Rast_set_c_null_value(out_row, cols);
+        for (col = SegmentLayer_next_valid(developed_segment, row, 0); col < cols;
+             col = SegmentLayer_next_valid(developed_segment, row, col + 1)) {
+            SegmentLayer_get(developed_segment, (void *)&developed, row, col);
+            if (Rast_is_c_null_value(&developed)) {
+                continue;
+            }
+            /* this handles undeveloped cells */
+            if (undeveloped_as_null && developed == -1)
+                continue;
+            /* this handles developed cells */
+            if (developed_as_one)
+                developed = 1;
+            out_row[col] = developed;
+        }
+        OutputMap_put_row(&out_map, out_row);
+    }
+    SegmentLayer_set_scan(developed_segment, false);
+    G_free(out_row);
+    OutputMap_close(&out_map);
+
+    write_metadata(name, year_from, year_to, nsteps, undeveloped_as_null, developed_as_one);
+}
+
+/*!
+ * \brief Write maps of developed areas of all steps in one pass
+ *
+ * The layer of development contains the step in which each cell was
+ * developed, so at the end of the simulation the map of any step
+ * can be derived from it. Each row of the layer is read once and
+ * written to all maps of the series, which are open at the same time
+ * (in batches of at most MAX_SERIES_MAPS maps).
+ * Developed cells are 1, other cells are NULL as in the series
+ * written after each step.
+ *
+ * \param developed_segment layer of developed cells
+ * \param basename basename for output maps
+ * \param years year of each step to put as timestamp
+ * \param nsteps total number of steps
+ */
+void output_developed_series(struct SegmentLayer *developed_segment, const char *basename,
+                             const int *years, int nsteps)
+{
+    struct OutputMap *out_maps;
+    char **names;
+    int row, col, rows, cols;
+    int first, last, step;
+    CELL *developed_row;
+    CELL *out_row;
+
+    rows = Rast_window_rows();
+    cols = Rast_window_cols();
+
+    out_maps = G_malloc(MAX_SERIES_MAPS * sizeof(struct OutputMap));
+    names = G_malloc(MAX_SERIES_MAPS * sizeof(char *));
+    developed_row = Rast_allocate_c_buf();
+    out_row = Rast_allocate_c_buf();
+    SegmentLayer_flush(developed_segment);
+    SegmentLayer_set_scan(developed_segment, true);
+    for (first = 0; first < nsteps; first += MAX_SERIES_MAPS) {
+        last = first + MAX_SERIES_MAPS < nsteps ? first + MAX_SERIES_MAPS : nsteps;
+        for (step = first; step < last; step++) {
+            names[step - first] = name_for_step(basename, step, nsteps);
+            OutputMap_open(&out_maps[step - first], names[step - first], true);
+        }
+        for (row = 0; row < rows; row++) {
+            G_percent(row, rows, 5);
+            Rast_set_c_null_value(developed_row, cols);
+            for (col = SegmentLayer_next_valid(developed_segment, row, 0); col < cols;
+                 col = SegmentLayer_next_valid(developed_segment, row, col + 1))
+                SegmentLayer_get(developed_segment, &developed_row[col], row, col);
+            /* cells developed in steps before the first map of the batch */
+            Rast_set_c_null_value(out_row, cols);
+            for (col = 0; col < cols; col++)
+                if (!Rast_is_c_null_value(&developed_row[col])
+                        && developed_row[col] >= 0 && developed_row[col] <= first)
+                    out_row[col] = 1;
+            /* step is saved as step + 1 */
+            for (step = first; step < last; step++) {
+                for (col = 0; col < cols; col++)
+                    if (developed_row[col] == step + 1)
+                        out_row[col] = 1;
+                OutputMap_put_row(&out_maps[step - first], out_row);
+            }
+        }
+        G_percent(row, rows, 5);
+        for (step = first; step < last; step++) {
+            OutputMap_close(&out_maps[step - first]);
+            write_metadata(names[step - first], years[step], -1, nsteps, true, true);
+            G_free(names[step - first]);
+        }
+    }
+    SegmentLayer_set_scan(developed_segment, false);
+    G_free(developed_row);
+    G_free(out_row);
+    G_free(out_maps);
+    G_free(names);
+}
+
+/*!
+ * \brief Create maps of the series as reclass of the final output
+ *
+ * Map of a step is 1 for cells with values from 0 (initial development)
+ * to the step in the final output and NULL otherwise, so it is stored
+ * only as a reclass table referring to the final output.
+ *
+ * \param output name of the final output map
+ * \param basename basename for output maps
+ * \param years year of each step to put as timestamp
+ * \param nsteps total number of steps
+ */
+void output_series_reclass(const char *output, const char *basename,
+                           const int *years, int nsteps)
+{
+    struct Reclass reclass;
+    char *name;
+    int step, value;
+
+    reclass.name = G_store(output);
+    reclass.mapset = G_store(G_mapset());
+    reclass.type = RECLASS_TABLE;
+    /* undeveloped -1 is NULL */
+    reclass.min = -1;
+    reclass.table = G_malloc((nsteps + 2) * sizeof(CELL));
+    for (step = 0; step < nsteps; step++) {
+        /* step is saved as step + 1 */
+        reclass.max = step + 1;
+        reclass.num = reclass.max - reclass.min + 1;
+        Rast_set_c_null_value(&reclass.table[0], 1);
+        for (value = 0; value <= reclass.max; value++)
+            reclass.table[value - reclass.min] = 1;
+        name = name_for_step(basename, step, nsteps);
+        if (Rast_put_reclass(name, &reclass) < 0)
+            G_fatal_error(_("Cannot create reclass raster map <%s>"), name);
+        write_metadata(name, years[step], -1, nsteps, true, true);
+        G_free(name);
+    }
+    G_free(reclass.table);
+    G_free(reclass.name);
+    G_free(reclass.mapset);
+}
+
+/* map of the series sent to the writer process followed by the name and cell states */
+struct SeriesRequest
+{
+    int year;
+    int nsteps;
+    // length of the name without the terminating zero (0 to finish)
+    int name_length;
+};
+
+/*!
+ * \brief Exit writer process without running exit handlers
+ */
+static void exit_writer(void *data)
+{
+    (void) data;
+    _exit(EXIT_FAILURE);
+}
+
+/*!
+ * \brief Read or write whole buffer from or to a pipe
+ * \return true on success, false on error or end of file
+ */
+static bool transfer_all(int fd, void *buffer, size_t size, bool write_data)
+{
+    char *data = buffer;
+    ssize_t n;
+
+    while (size > 0) {
+        n = write_data ? write(fd, data, size) : read(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*!
+ * \brief Write developed cells as 1 and other cells as NULL from cell states
+ * \param states development state of cells
+ * \param name name for output map
+ * \param year year to put as timestamp
+ * \param nsteps total number of steps
+ */
+static void output_developed_states(const struct CellStates *states, const char *name,
+                                    int year, int nsteps)
+{
+    struct OutputMap out_map;
+    int row, col;
+    CELL *out_row;
+
+    OutputMap_open(&out_map, name, true);
+    out_row = Rast_allocate_c_buf();
+    for (row = 0; row < states->rows; row++) {
+        Rast_set_c_null_value(out_row, states->cols);
+        for (col = 0; col < states->cols; col++)
+            if (CellStates_get(states, row, col) == STATE_DEVELOPED)
+                out_row[col] = 1;
+        OutputMap_put_row(&out_map, out_row);
+    }
+    G_free(out_row);
+    OutputMap_close(&out_map);
+
+    write_metadata(name, year, -1, nsteps, true, true);
+}
+
+/*!
+ * \brief Write maps received from the simulation until asked to finish
+ *
+ * Runs in the writer process, each written map is confirmed
+ * by sending back its year.
+ *
+ * \param request_fd pipe with requests
+ * \param reply_fd pipe for confirmations
+ * \param rows number of rows
+ * \param cols number of columns
+ */
+static void run_writer(int request_fd, int reply_fd, int rows, int cols)
+{
+    struct SeriesRequest request;
+    struct CellStates states;
+    char *name;
+
+    states.rows = rows;
+    states.cols = cols;
+    states.bits = G_malloc(((size_t) rows * cols + 3) / 4);
+    while (transfer_all(request_fd, &request, sizeof(request), false)
+           && request.name_length > 0) {
+        name = G_malloc(request.name_length + 1);
+        if (!transfer_all(request_fd, name, request.name_length, false)
+                || !transfer_all(request_fd, states.bits, ((size_t) rows * cols + 3) / 4, false))
+            break;
+        name[request.name_length] = '\0';
+        output_developed_states(&states, name, request.year, request.nsteps);
+        G_free(name);
+        fflush(stdout);
+        fflush(stderr);
+        if (!transfer_all(reply_fd, &request.year, sizeof(request.year), true))
+            break;
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/*!
+ * \brief Initialize writer of maps of the series writing the maps directly
+ * \param writer series writer
+ */
+void SeriesWriter_init(struct SeriesWriter *writer)
+{
+    writer->pid = 0;
+    writer->name = NULL;
+    writer->size = 0;
+}
+
+/*!
+ * \brief Start process writing maps of the series in the background
+ *
+ * The writer process is started before the inputs are read,
+ * so it shares almost no memory with the simulation, and it never sees
+ * the segments or their files. For each map, the cell states are
+ * copied to the process through a pipe, so the process keeps one copy
+ * of the cell states (2 bits per cell) which is counted as used memory.
+ * If the process cannot be started, the maps are written directly.
+ *
+ * \param writer series writer initialized by SeriesWriter_init()
+ * \param rows number of rows
+ * \param cols number of columns
+ */
+void SeriesWriter_start(struct SeriesWriter *writer, int rows, int cols)
+{
+    int request_pipe[2], reply_pipe[2];
+    pid_t pid;
+
+    writer->size = ((size_t) rows * cols + 3) / 4;
+    if (pipe(request_pipe) < 0)
+        return;
+    if (pipe(reply_pipe) < 0) {
+        close(request_pipe[0]);
+        close(request_pipe[1]);
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid == 0) {
+        G_add_error_handler(exit_writer, NULL);
+        close(request_pipe[1]);
+        close(reply_pipe[0]);
+        run_writer(request_pipe[0], reply_pipe[1], rows, cols);
+    }
+    close(request_pipe[0]);
+    close(reply_pipe[1]);
+    if (pid < 0) {
+        close(request_pipe[1]);
+        close(reply_pipe[0]);
+        return;
+    }
+    /* failed writes to the pipe are reported instead */
+    signal(SIGPIPE, SIG_IGN);
+    writer->pid = pid;
+    writer->request_fd = request_pipe[1];
+    writer->reply_fd = reply_pipe[0];
+    track_memory(MEMORY_CELL_INDEX, writer->size);
+}
+
+/*!
+ * \brief Write map of developed areas in the background
+ *
+ * The cell states are sent to the writer process,
+ * so the simulation continues with the next step while the map
+ * is encoded and written. At most one map is written at a time,
+ * so the previous one is waited for.
+ *
+ * \param writer series writer
+ * \param states development state of cells
+ * \param name name for output map (freed by the writer)
+ * \param year year to put as timestamp
+ * \param nsteps total number of steps (needed for color table)
+ */
+void SeriesWriter_write(struct SeriesWriter *writer, const struct CellStates *states,
+                        char *name, int year, int nsteps)
+{
+    struct SeriesRequest request;
+
+    SeriesWriter_wait(writer);
+    if (writer->pid <= 0) {
+        output_developed_states(states, name, year, nsteps);
+        G_free(name);
+        return;
+    }
+    request.year = year;
+    request.nsteps = nsteps;
+    request.name_length = strlen(name);
+    writer->name = name;
+    if (!transfer_all(writer->request_fd, &request, sizeof(request), true)
+            || !transfer_all(writer->request_fd, name, request.name_length, true)
+            || !transfer_all(writer->request_fd, states->bits, writer->size, true))
+        G_fatal_error(_("Failed to write raster map <%s>"), name);
+}
+
+/*!
+ * \brief Wait until the map being written in the background is finished
+ * \param writer series writer
+ */
+void SeriesWriter_wait(struct SeriesWriter *writer)
+{
+    int year;
+
+    if (!writer->name)
+        return;
+    if (!transfer_all(writer->reply_fd, &year, sizeof(year), false))
+        G_fatal_error(_("Failed to write raster map <%s>"), writer->name);
+    G_free(writer->name);
+    writer->name = NULL;
+}
+
+/*!
+ * \brief Wait for the last map and end the writer process
+ * \param writer series writer
+ */
+void SeriesWriter_finish(struct SeriesWriter *writer)
+{
+    struct SeriesRequest request;
+    int status;
+
+    SeriesWriter_wait(writer);
+    if (writer->pid <= 0)
+        return;
+    G_zero(&request, sizeof(request));
+    transfer_all(writer->request_fd, &request, sizeof(request), true);
+    close(writer->request_fd);
+    close(writer->reply_fd);
+    if (waitpid(writer->pid, &status, 0) < 0 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != EXIT_SUCCESS)
+        G_fatal_error(_("Failed to finish writing output series"));
+    writer->pid = 0;
+    untrack_memory(MEMORY_CELL_INDEX, writer->size);
+}
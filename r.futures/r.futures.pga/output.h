@@ -3,10 +3,40 @@
 
 #include <grass/segment.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
+#include "cellstates.h"
+#include "segments.h"
 
+/* maximum number of series maps open at the same time */
+#define MAX_SERIES_MAPS 64
 
+/* writer of maps of the series in a background process */
+struct SeriesWriter
+{
+    // process writing the maps (0 if they are written directly)
+    pid_t pid;
+    // pipes to send maps to the process and to receive confirmations
+    int request_fd;
+    int reply_fd;
+    // size of cell states sent for each map
+    size_t size;
+    // name of the map being written (NULL if none)
+    char *name;
+};
+
+void set_geotiff_directory(const char *directory);
 char *name_for_step(const char *basename, const int step, const int nsteps);
-void output_developed_step(SEGMENT *developed_segment, const char *name, int year_from, int year_to,
+void output_developed_step(struct SegmentLayer *developed_segment, const char *name, int year_from, int year_to,
                            int nsteps, bool undeveloped_as_null, bool developed_as_one);
+void output_developed_series(struct SegmentLayer *developed_segment, const char *basename,
+                             const int *years, int nsteps);
+void output_series_reclass(const char *output, const char *basename,
+                           const int *years, int nsteps);
+void SeriesWriter_init(struct SeriesWriter *writer);
+void SeriesWriter_start(struct SeriesWriter *writer, int rows, int cols);
+void SeriesWriter_write(struct SeriesWriter *writer, const struct CellStates *states,
+                        char *name, int year, int nsteps);
+void SeriesWriter_wait(struct SeriesWriter *writer);
+void SeriesWriter_finish(struct SeriesWriter *writer);
 #endif // FUTURES_OUTPUT_H
@@ -25,6 +25,7 @@
 #include "inputs.h"
 #include "patch.h"
 #include "utils.h"
+#include "memusage.h"
 
 
 
@@ -67,9 +68,14 @@ static float get_alpha(struct PatchInfo *patch_info)
  */
 int get_patch_size(struct PatchSizes *patch_sizes, int region)
 {
-    if (patch_sizes->single_column)
-        region = 0;
-    return patch_sizes->patch_sizes[region][(int)(G_drand48() * patch_sizes->patch_count[region])];
+    int column;
+    size_t start;
+    int count;
+
+    column = patch_sizes->single_column ? 0 : patch_sizes->region_column[region];
+    start = patch_sizes->column_offset[column];
+    count = patch_sizes->column_offset[column + 1] - start;
+    return patch_sizes->sizes[start + (int)(G_drand48() * count)];
 }
 /*!
  * \brief Decides if to add a cell to a candidate list for patch growing
@@ -96,16 +102,12 @@ void add_neighbour(int row, int col, int seed_row, int seed_col, int rows, int c
     double distance;
     float alpha;
     size_t idx;
-    CELL value;
     FCELL prob;
 
     if (row < 0 || row >= rows || col < 0 || col >= cols)
         return;
 
-    Segment_get(&segments->developed, (void *)&value, row, col);
-    if (Rast_is_null_value(&value, CELL_TYPE))
-        return;
-    if (value == -1) {
+    if (CellStates_get(&segments->states, row, col) == STATE_UNDEVELOPED) {
         idx = get_idx_from_xy(row, col, Rast_window_cols());
         /* need to add this cell... */
         
@@ -119,13 +121,14 @@ void add_neighbour(int row, int col, int seed_row, int seed_col, int rows, int c
         if (candidate_list->n == candidate_list->max_n) {
             candidate_list->max_n += candidate_list->block_size;
             candidate_list->candidates =  (struct CandidateNeighbor *)
-                    G_realloc(candidate_list->candidates, candidate_list->max_n * sizeof(struct CandidateNeighbor));
+                    tracked_realloc(MEMORY_CANDIDATES, candidate_list->candidates,
+                                    candidate_list->max_n * sizeof(struct CandidateNeighbor));
             if (!candidate_list->candidates) {
                 G_fatal_error("Memory error in add_neighbour_if_possible()");
             }
         }
         candidate_list->candidates[candidate_list->n].id = idx;
-        Segment_get(&segments->probability, (void *)&prob, row, col);
+        SegmentLayer_get(&segments->probability, (void *)&prob, row, col);
         candidate_list->candidates[candidate_list->n].potential = prob;
         distance = get_distance(seed_row, seed_col, row, col);
         alpha = get_alpha(patch_info);
@@ -196,7 +199,7 @@ void add_neighbours(int row, int col, int seed_row, int seed_col,
  */
 int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
                struct PatchInfo *patch_info, struct Segments *segments,
-                int *patch_overflow, int *added_ids)
+                int *patch_overflow, size_t *added_ids)
 {
     int i, j, iter;
     double r, p;
@@ -207,7 +210,8 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
 
     struct CandidateNeighborsList candidates;
     candidates.block_size = 20;
-    candidates.candidates = (struct CandidateNeighbor *) G_malloc(sizeof(struct CandidateNeighbor) * candidates.block_size);
+    candidates.candidates = (struct CandidateNeighbor *) tracked_malloc(MEMORY_CANDIDATES,
+                                                                        sizeof(struct CandidateNeighbor) * candidates.block_size);
     candidates.max_n = candidates.block_size;
     candidates.n = 0;
     
@@ -220,7 +224,11 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
     step += 1;  /* e.g. first step=0 will be saved as 1 */
 
     /* set seed as developed */
-    Segment_put(&segments->developed, (void *)&step, seed_row, seed_col);
+    SegmentLayer_put(&segments->developed, (void *)&step, seed_row, seed_col);
+    if (patch_info->events) {
+        EventLog_start_patch(patch_info->events, step, region);
+        EventLog_add(patch_info->events, seed_row, seed_col);
+    }
     added_ids[0] = get_idx_from_xy(seed_row, seed_col, Rast_window_cols());
 
     /* add surrounding neighbors */
@@ -238,7 +246,9 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
                 added_ids[found] = candidates.candidates[i].id;
                 /* update to developed */
                 get_xy_from_idx(candidates.candidates[i].id, cols, &row, &col);
-                Segment_put(&segments->developed, (void *)&step, row, col);
+                SegmentLayer_put(&segments->developed, (void *)&step, row, col);
+                if (patch_info->events)
+                    EventLog_add(patch_info->events, row, col);
                 /* remove this one from the list by copying down everything above it */
                 for (j = i + 1; j < candidates.n; j++) {
                     candidates.candidates[j - 1].id = candidates.candidates[j].id;
@@ -252,7 +262,7 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
                                &candidates, segments, patch_info);
                 /* sort candidates based on probability */
                 qsort(candidates.candidates, candidates.n, sizeof(struct CandidateNeighbor), sort_neighbours);
-                Segment_get(&segments->subregions, (void *)&test_region, row, col);
+                SegmentLayer_get(&segments->subregions, (void *)&test_region, row, col);
                 /* if growing outside of region, account for that, increase number of cells outside of region */
                 if (test_region != region)
                     patch_overflow[test_region]++;
@@ -286,9 +296,8 @@ int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
     }
 
     if (candidates.max_n > 0)
-        G_free(candidates.candidates);
+        tracked_free(MEMORY_CANDIDATES, candidates.candidates);
 
-    Segment_flush(&segments->developed);
     return found_in_this_region;
 }
 
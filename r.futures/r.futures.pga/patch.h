@@ -3,6 +3,7 @@
 
 #include <grass/segment.h>
 
+#include "eventlog.h"
 #include "inputs.h"
 
 
@@ -33,7 +34,8 @@ struct PatchInfo
     float compactness_mean;
     float compactness_range;
     enum slow_grow strategy;
-    
+    // log of developed cells (or NULL)
+    struct EventLog *events;
 };
 
 int get_patch_size(struct PatchSizes *patch_sizes, int region);
@@ -47,6 +49,6 @@ void add_neighbours(int row, int col, int seed_row, int seed_col,
                     struct PatchInfo *patch_info);
 double get_distance(int row1, int col1, int row2, int col2);
 int grow_patch(int seed_row, int seed_col, int patch_size, int step, int region,
-               struct PatchInfo *patch_info, struct Segments *segments, int *patch_overflow, int *added_ids);
+               struct PatchInfo *patch_info, struct Segments *segments, int *patch_overflow, size_t *added_ids);
 
 #endif // FUTURES_PATCH_H
@@ -0,0 +1,1069 @@
+/*!
+   \file segments.c
+
+   \brief Functions to store raster layers in segments
+
+   Layers which are accessed together for the same cell can be stored
+   interleaved as one record per cell in a single segment, so that
+   one tile in the cache contains everything needed for that cell.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include <grass/segment.h>
+
+#include "segments.h"
+#include "memusage.h"
+
+/* store only valid cells when there is at most this fraction of them */
+#define COMPACT_MAX_FRACTION 0.9
+
+/*!
+ * \brief Get memory allocated by GRASS segment library for tiles
+ * \param segment open segment
+ * \return size in bytes
+ */
+static size_t get_segment_memory(const SEGMENT *segment)
+{
+    return (size_t) segment->nseg * segment->srows * segment->scols * segment->len;
+}
+
+/*!
+ * \brief Create segment in a new file without filling it
+ *
+ * Segment_open() writes zeros to the whole file before it can be used.
+ * Every layer is written before it is read, so here only the header
+ * is written and the rest of the file stays sparse.
+ *
+ * \param store store
+ * \param len size of record in bytes
+ * \param segment_info tile size and number of tiles in memory
+ * \return 1 on success, negative value on error
+ */
+static int open_sparse_segment(struct CellStore *store, int len,
+                               struct SegmentMemory segment_info)
+{
+    int fd, ret;
+
+    store->filename = G_tempfile();
+    fd = creat(store->filename, 0666);
+    if (fd < 0)
+        return -1;
+    ret = Segment_format_nofill(fd, Rast_window_rows(), Rast_window_cols(),
+                                segment_info.rows, segment_info.cols, len);
+    close(fd);
+    if (ret != 1)
+        return ret;
+    store->fd = open(store->filename, O_RDWR);
+    if (store->fd < 0)
+        return -1;
+    ret = Segment_init(&store->segment, store->fd, segment_info.in_memory);
+    if (ret == 1)
+        track_memory(MEMORY_TILES, get_segment_memory(&store->segment));
+    return ret;
+}
+
+/*!
+ * \brief Open tiled store for cell records of given size
+ * \param store store to open
+ * \param segments segments with backend and valid cells set
+ * \param len size of record in bytes
+ * \param segment_info tile size and number of tiles in memory
+ * \param name description of the content for error messages
+ */
+static void open_store(struct CellStore *store, const struct Segments *segments, int len,
+                       struct SegmentMemory segment_info, const char *name)
+{
+    enum storage_backend backend = segments->backend;
+
+    store->backend = backend;
+    store->name = name;
+    store->valid = segments->valid;
+    if (backend == BACKEND_SEGMENT) {
+        if (open_sparse_segment(store, len, segment_info) != 1)
+            G_fatal_error(_("Cannot create temporary file with segments of %s"), name);
+    }
+    else {
+        TileStore_open(&store->tiles, G_tempfile(), Rast_window_rows(), Rast_window_cols(),
+                       segment_info.rows, segment_info.cols, len,
+                       backend == BACKEND_CACHE ? segment_info.in_memory : 0,
+                       segments->compact ? segments->valid : NULL, segments->tile_order);
+        /* memory for compressed tiles is divided by size of records */
+        if (segments->compressed_memory > 0)
+            TileStore_set_compression(&store->tiles, segments->compressor,
+                                      segments->compressed_memory * len
+                                      / get_segments_cell_size(segments));
+    }
+    store->len = len;
+    store->record = G_malloc(len);
+    store->row = G_malloc((size_t) len * Rast_window_cols());
+}
+
+static void close_store(struct CellStore *store)
+{
+    size_t total;
+
+    if (store->backend == BACKEND_CACHE) {
+        total = store->tiles.hits + store->tiles.misses;
+        G_verbose_message(_("Tile cache of %s: %lu hits, %lu misses (%.2f%% hit rate), "
+                            "%lu tiles written, %lu tiles prefetched"), store->name,
+                          (unsigned long) store->tiles.hits,
+                          (unsigned long) store->tiles.misses,
+                          total ? 100. * store->tiles.hits / total : 100.,
+                          (unsigned long) store->tiles.writes,
+                          (unsigned long) store->tiles.prefetches);
+        if (store->tiles.compressor)
+            G_verbose_message(_("Compressed tiles of %s: %lu tiles compressed "
+                                "with ratio %.2f, %lu decompressed, %lu written to disk"),
+                              store->name, (unsigned long) store->tiles.packs,
+                              store->tiles.packed_total
+                                  ? (double) store->tiles.raw_bytes / store->tiles.packed_total
+                                  : 1.,
+                              (unsigned long) store->tiles.unpacks,
+                              (unsigned long) store->tiles.spills);
+    }
+    if (store->backend != BACKEND_SEGMENT)
+        TileStore_close(&store->tiles);
+    else {
+        untrack_memory(MEMORY_TILES, get_segment_memory(&store->segment));
+        Segment_release(&store->segment);
+        close(store->fd);
+        unlink(store->filename);
+        G_free(store->filename);
+    }
+    G_free(store->record);
+    G_free(store->row);
+}
+
+static void store_get_row(struct CellStore *store, void *buf, int row)
+{
+    if (store->backend != BACKEND_SEGMENT)
+        TileStore_get_row(&store->tiles, buf, row);
+    else
+        Segment_get_row(&store->segment, buf, row);
+}
+
+static void store_put_row(struct CellStore *store, const void *buf, int row)
+{
+    if (store->backend != BACKEND_SEGMENT)
+        TileStore_put_row(&store->tiles, buf, row);
+    else
+        Segment_put_row(&store->segment, buf, row);
+}
+
+static void set_layer_type(struct SegmentLayer *layer, RASTER_MAP_TYPE type,
+                           enum layer_storage storage)
+{
+    layer->type = type;
+    layer->storage = storage;
+    layer->value_offset = 0;
+    layer->value_scale = 1;
+    if (storage == STORE_INT8 || storage == STORE_QUANTIZED_INT8)
+        layer->size = sizeof(signed char);
+    else if (storage == STORE_UINT16 || storage == STORE_FLOAT16
+             || storage == STORE_BFLOAT16 || storage == STORE_SCALED_INT16)
+        layer->size = sizeof(uint16_t);
+    else
+        layer->size = Rast_cell_size(type);
+}
+
+/*!
+ * \brief Pick the narrowest type to store each layer.
+ *
+ * Developed holds -1, NULL or step number, so it fits into int8
+ * when there are at most 127 steps. Subregion indices fit into uint16
+ * when there are at most 65535 subregions. Weights can be optionally
+ * quantized to int8 (lossy).
+ *
+ * \param segments segments
+ * \param max_steps maximum number of simulated steps
+ * \param num_regions upper bound of number of subregions
+ * \param num_potential_regions upper bound of number of potential subregions
+ * \param quantize_weight store weights as int8
+ * \param float_storage storage of development pressure and aggregated predictors
+ * (STORE_NATIVE, STORE_FLOAT16, STORE_BFLOAT16 or STORE_SCALED_INT16)
+ */
+void set_storage_types(struct Segments *segments, int max_steps, int num_regions,
+                       int num_potential_regions, bool quantize_weight,
+                       enum layer_storage float_storage)
+{
+    set_layer_type(&segments->developed, CELL_TYPE,
+                   max_steps <= SCHAR_MAX ? STORE_INT8 : STORE_NATIVE);
+    set_layer_type(&segments->subregions, CELL_TYPE,
+                   num_regions <= USHRT_MAX ? STORE_UINT16 : STORE_NATIVE);
+    set_layer_type(&segments->potential_subregions, CELL_TYPE,
+                   num_potential_regions <= USHRT_MAX ? STORE_UINT16 : STORE_NATIVE);
+    set_layer_type(&segments->devpressure, FCELL_TYPE, float_storage);
+    set_layer_type(&segments->aggregated_predictor, FCELL_TYPE, float_storage);
+    set_layer_type(&segments->probability, FCELL_TYPE, STORE_NATIVE);
+    set_layer_type(&segments->weight, FCELL_TYPE,
+                   quantize_weight ? STORE_QUANTIZED_INT8 : STORE_NATIVE);
+    G_verbose_message(_("Storing developed in %d, subregions in %d bytes per cell"),
+                      segments->developed.size, segments->subregions.size);
+}
+
+/*!
+ * \brief Get size of all layers per cell in bytes
+ * \param segments segments with storage types set
+ * \return size in bytes
+ */
+size_t get_segments_cell_size(const struct Segments *segments)
+{
+    size_t size;
+
+    size = segments->developed.size + segments->subregions.size;
+    size += segments->devpressure.size + segments->aggregated_predictor.size;
+    size += segments->probability.size;
+    if (segments->use_weight)
+        size += segments->weight.size;
+    if (segments->use_potential_subregions)
+        size += segments->potential_subregions.size;
+    return size;
+}
+
+/*!
+ * \brief Get number of cells stored in each layer
+ *
+ * Only cells with data are stored when they are known, the backend
+ * allows it and there are enough cells without data.
+ *
+ * \param segments segments with backend and valid set
+ * \return number of stored cells
+ */
+size_t get_segments_stored_cells(const struct Segments *segments)
+{
+    size_t ncells;
+
+    ncells = (size_t) Rast_window_rows() * Rast_window_cols();
+    if (segments->valid && segments->backend != BACKEND_SEGMENT
+            && segments->valid->count <= COMPACT_MAX_FRACTION * ncells)
+        return segments->valid->count;
+    return ncells;
+}
+
+/*!
+ * \brief Set up layer either with its own segment or in the shared store
+ * \param segments segments
+ * \param layer layer to set up with type already set
+ * \param segment_info tile size and number of tiles in memory
+ * \param name description of the layer for error messages
+ */
+static void open_layer(struct Segments *segments, struct SegmentLayer *layer,
+                       struct SegmentMemory segment_info, const char *name)
+{
+    layer->open = true;
+    layer->states = NULL;
+    if (segments->interleaved) {
+        layer->store = &segments->records;
+        layer->offset = segments->records.len;
+        layer->shared = true;
+        segments->records.len += layer->size;
+    }
+    else {
+        layer->store = (struct CellStore *) G_malloc(sizeof(struct CellStore));
+        layer->offset = 0;
+        layer->shared = false;
+        open_store(layer->store, segments, layer->size, segment_info, name);
+    }
+}
+
+/*!
+ * \brief Open all layers used in the simulation.
+ *
+ * When interleaved, all layers are stored as one record per cell
+ * in a single segment. When valid cells are known and the backend
+ * allows it, only valid cells are stored if there are enough cells
+ * without data.
+ *
+ * \param segments segments with use_weight, use_potential_subregions,
+ * interleaved, valid and storage types set
+ * \param segment_info tile size and number of tiles in memory
+ */
+void open_segments(struct Segments *segments, struct SegmentMemory segment_info)
+{
+    int ntiles;
+
+    ntiles = ((Rast_window_rows() + segment_info.rows - 1) / segment_info.rows) *
+             ((Rast_window_cols() + segment_info.cols - 1) / segment_info.cols);
+    segments->memory = segment_info;
+    segments->limited_memory = segment_info.in_memory < ntiles;
+    segments->compact = get_segments_stored_cells(segments)
+            < (size_t) Rast_window_rows() * Rast_window_cols();
+    if (segments->compact)
+        G_verbose_message(_("Storing only %lu cells with data"),
+                          (unsigned long) segments->valid->count);
+    segments->records.len = 0;
+    segments->potential_subregions.open = false;
+    segments->weight.open = false;
+
+    open_layer(segments, &segments->developed, segment_info,
+               _("a raster map of development"));
+    CellStates_create(&segments->states, Rast_window_rows(), Rast_window_cols());
+    segments->developed.states = &segments->states;
+    open_layer(segments, &segments->subregions, segment_info,
+               _("a raster map of subregions"));
+    if (segments->use_potential_subregions)
+        open_layer(segments, &segments->potential_subregions, segment_info,
+                   _("a raster map of potential subregions"));
+    open_layer(segments, &segments->devpressure, segment_info,
+               _("a raster map of development pressure"));
+    open_layer(segments, &segments->aggregated_predictor, segment_info,
+               _("predictor raster maps"));
+    open_layer(segments, &segments->probability, segment_info,
+               _("a raster map of probability"));
+    if (segments->use_weight)
+        open_layer(segments, &segments->weight, segment_info,
+                   _("a raster map of weights"));
+    if (segments->interleaved) {
+        open_store(&segments->records, segments, segments->records.len,
+                   segment_info, _("interleaved raster maps"));
+        G_verbose_message(_("Using interleaved records of %d bytes per cell"),
+                          segments->records.len);
+    }
+}
+
+static void close_layer(struct SegmentLayer *layer)
+{
+    if (!layer->open)
+        return;
+    if (!layer->shared) {
+        close_store(layer->store);
+        G_free(layer->store);
+    }
+    layer->open = false;
+}
+
+/*!
+ * \brief Close all layers and free the buffers
+ * \param segments segments
+ */
+void close_segments(struct Segments *segments)
+{
+    close_layer(&segments->developed);
+    close_layer(&segments->subregions);
+    close_layer(&segments->potential_subregions);
+    close_layer(&segments->devpressure);
+    close_layer(&segments->aggregated_predictor);
+    close_layer(&segments->probability);
+    close_layer(&segments->weight);
+    if (segments->interleaved)
+        close_store(&segments->records);
+    CellStates_free(&segments->states);
+}
+
+/*!
+ * \brief Write modified tiles of all layers to disk
+ *
+ * Modified tiles are otherwise written when they are evicted
+ * from memory. All accesses go through the cache, so this is not
+ * needed for consistency, only to limit the amount of unwritten tiles.
+ *
+ * \param segments segments
+ */
+void flush_segments(struct Segments *segments)
+{
+    /* all layers share one store */
+    if (segments->interleaved) {
+        SegmentLayer_flush(&segments->developed);
+        return;
+    }
+    SegmentLayer_flush(&segments->developed);
+    SegmentLayer_flush(&segments->subregions);
+    if (segments->use_potential_subregions)
+        SegmentLayer_flush(&segments->potential_subregions);
+    SegmentLayer_flush(&segments->devpressure);
+    SegmentLayer_flush(&segments->aggregated_predictor);
+    SegmentLayer_flush(&segments->probability);
+    if (segments->use_weight)
+        SegmentLayer_flush(&segments->weight);
+}
+
+/*!
+ * \brief Start reading segments in a window in the background
+ *
+ * Segments are stored after the file header row by row.
+ *
+ * \param store store with GRASS segment
+ * \param row1 first row of the window (can be outside)
+ * \param col1 first column of the window (can be outside)
+ * \param row2 last row of the window (can be outside)
+ * \param col2 last column of the window (can be outside)
+ */
+static void prefetch_segments(struct CellStore *store, int row1, int col1, int row2, int col2)
+{
+    SEGMENT *segment = &store->segment;
+    int segment_row, first;
+
+    if (row1 < 0)
+        row1 = 0;
+    if (col1 < 0)
+        col1 = 0;
+    if (row2 >= segment->nrows)
+        row2 = segment->nrows - 1;
+    if (col2 >= segment->ncols)
+        col2 = segment->ncols - 1;
+    if (row1 > row2 || col1 > col2)
+        return;
+    for (segment_row = row1 / segment->srows; segment_row <= row2 / segment->srows;
+         segment_row++) {
+        first = segment_row * segment->spr + col1 / segment->scols;
+        posix_fadvise(store->fd, segment->offset + (off_t) first * segment->size,
+                      (off_t) (col2 / segment->scols - col1 / segment->scols + 1)
+                      * segment->size, POSIX_FADV_WILLNEED);
+    }
+}
+
+static void advise_store(struct CellStore *store, int row1, int col1,
+                         int row2, int col2, enum tile_advice advice)
+{
+    if (store->backend != BACKEND_SEGMENT)
+        TileStore_advise(&store->tiles, row1, col1, row2, col2, advice);
+    else if (advice == TILES_WILLNEED)
+        prefetch_segments(store, row1, col1, row2, col2);
+}
+
+static void advise_layer(struct SegmentLayer *layer, int row1, int col1,
+                         int row2, int col2, enum tile_advice advice)
+{
+    if (layer->open && !layer->shared)
+        advise_store(layer->store, row1, col1, row2, col2, advice);
+}
+
+/*!
+ * \brief Advise future use of tiles in a window for all layers
+ *
+ * With memory-mapped tiles, the kernel is advised directly.
+ * Otherwise, tiles which are going to be needed and are not in memory
+ * are read by the kernel in the background, so the simulation doesn't
+ * wait for the disk when it accesses them. Has no effect when
+ * all tiles fit into memory.
+ *
+ * \param segments segments
+ * \param row1 first row of the window (can be outside)
+ * \param col1 first column of the window (can be outside)
+ * \param row2 last row of the window (can be outside)
+ * \param col2 last column of the window (can be outside)
+ * \param advice WILLNEED or DONTNEED
+ */
+void advise_segments(struct Segments *segments, int row1, int col1, int row2, int col2,
+                     enum tile_advice advice)
+{
+    if (segments->backend != BACKEND_MMAP && !segments->limited_memory)
+        return;
+    if (segments->interleaved) {
+        advise_store(&segments->records, row1, col1, row2, col2, advice);
+        return;
+    }
+    advise_layer(&segments->developed, row1, col1, row2, col2, advice);
+    advise_layer(&segments->subregions, row1, col1, row2, col2, advice);
+    advise_layer(&segments->potential_subregions, row1, col1, row2, col2, advice);
+    advise_layer(&segments->devpressure, row1, col1, row2, col2, advice);
+    advise_layer(&segments->aggregated_predictor, row1, col1, row2, col2, advice);
+    advise_layer(&segments->probability, row1, col1, row2, col2, advice);
+    advise_layer(&segments->weight, row1, col1, row2, col2, advice);
+}
+
+/*!
+ * \brief Get tile stores of all open layers
+ * \param segments segments
+ * \param[out] stores array for at least 7 stores
+ * \return number of stores (0 with GRASS segment library)
+ */
+static int get_tile_stores(struct Segments *segments, struct TileStore **stores)
+{
+    int i, n;
+    struct SegmentLayer *layers[] = {&segments->developed, &segments->subregions,
+                                     &segments->potential_subregions, &segments->devpressure,
+                                     &segments->aggregated_predictor, &segments->probability,
+                                     &segments->weight};
+
+    if (segments->backend == BACKEND_SEGMENT)
+        return 0;
+    if (segments->interleaved) {
+        stores[0] = &segments->records.tiles;
+        return 1;
+    }
+    n = 0;
+    for (i = 0; i < 7; i++)
+        if (layers[i]->open)
+            stores[n++] = &layers[i]->store->tiles;
+    return n;
+}
+
+/*!
+ * \brief Reduce tile caches when the simulation uses more than the memory limit
+ *
+ * Other structures (mainly the list of undeveloped cells) grow during
+ * the simulation, so the cached tiles are reduced to keep the total
+ * within the limit. Only tiles cached by the module can be released,
+ * the memory used by GRASS segment library or by the kernel for
+ * memory-mapped tiles stays the same.
+ *
+ * \param segments segments
+ */
+void limit_segments_memory(struct Segments *segments)
+{
+    int i, n;
+    struct TileStore *stores[7];
+    size_t used, excess, cached, cached_before;
+    double fraction;
+    static bool warned = false;
+
+    if (!segments->memory_limit)
+        return;
+    /* compressed tiles have their own limit */
+    used = get_total_memory_usage() - get_memory_usage(MEMORY_COMPRESSED_TILES);
+    if (used <= segments->memory_limit)
+        return;
+    excess = used - segments->memory_limit;
+    cached_before = get_memory_usage(MEMORY_TILES);
+    n = segments->backend == BACKEND_CACHE ? get_tile_stores(segments, stores) : 0;
+    cached = 0;
+    for (i = 0; i < n; i++)
+        cached += stores[i]->nslots * stores[i]->tile_size;
+    if (excess >= cached)
+        fraction = 0;
+    else
+        fraction = (double) (cached - excess) / cached;
+    for (i = 0; i < n; i++)
+        TileStore_shrink(stores[i], stores[i]->nslots * fraction);
+    if (get_memory_usage(MEMORY_TILES) < cached_before) {
+        segments->limited_memory = true;
+        G_verbose_message(_("Tile cache reduced to %.1f MB to fit into memory limit"),
+                          get_memory_usage(MEMORY_TILES) / 1e6);
+    }
+    used = get_total_memory_usage() - get_memory_usage(MEMORY_COMPRESSED_TILES);
+    if (used > segments->memory_limit && !warned) {
+        G_warning(_("Memory limit exceeded by %.1f MB"),
+                  (used - segments->memory_limit) / 1e6);
+        warned = true;
+    }
+}
+
+/*!
+ * \brief Keep tiles in a window in memory until unpinned
+ *
+ * Used for the tiles around a growing patch. With memory-mapped
+ * backend and GRASS segment library, the tiles are only advised as needed.
+ *
+ * \param segments segments
+ * \param row1 first row of the window (can be outside)
+ * \param col1 first column of the window (can be outside)
+ * \param row2 last row of the window (can be outside)
+ * \param col2 last column of the window (can be outside)
+ */
+void pin_segments(struct Segments *segments, int row1, int col1, int row2, int col2)
+{
+    int i, n;
+    struct TileStore *stores[7];
+
+    /* segments can be only read in advance */
+    if (segments->backend == BACKEND_SEGMENT) {
+        advise_segments(segments, row1, col1, row2, col2, TILES_WILLNEED);
+        return;
+    }
+    n = get_tile_stores(segments, stores);
+    for (i = 0; i < n; i++)
+        TileStore_pin(stores[i], row1, col1, row2, col2);
+}
+
+/*!
+ * \brief Release all pinned tiles
+ * \param segments segments
+ */
+void unpin_segments(struct Segments *segments)
+{
+    int i, n;
+    struct TileStore *stores[7];
+
+    n = get_tile_stores(segments, stores);
+    for (i = 0; i < n; i++)
+        TileStore_unpin(stores[i]);
+}
+
+/*!
+ * \brief Mark following accesses as a sweep over all cells
+ *
+ * Tiles read by the sweep then don't evict the tiles used repeatedly.
+ *
+ * \param segments segments
+ * \param scan true at the start of the sweep, false at the end
+ */
+void set_segments_scan(struct Segments *segments, bool scan)
+{
+    int i, n;
+    struct TileStore *stores[7];
+
+    n = get_tile_stores(segments, stores);
+    for (i = 0; i < n; i++)
+        stores[i]->scan = scan;
+}
+
+/*!
+ * \brief Mark following accesses of a layer as a sweep over all cells
+ * \param layer layer
+ * \param scan true at the start of the sweep, false at the end
+ */
+void SegmentLayer_set_scan(struct SegmentLayer *layer, bool scan)
+{
+    if (layer->store->backend != BACKEND_SEGMENT)
+        layer->store->tiles.scan = scan;
+}
+
+/*!
+ * \brief Convert float to IEEE half precision (round to nearest even)
+ * \param value float value
+ * \return half precision bits
+ */
+static uint16_t float_to_half(float value)
+{
+    union {float f; uint32_t u;} v;
+    uint32_t sign, mantissa, half, rest, halfway;
+    int exponent, shift;
+
+    v.f = value;
+    sign = (v.u >> 16) & 0x8000;
+    exponent = (int) ((v.u >> 23) & 0xff) - 127 + 15;
+    mantissa = v.u & 0x7fffff;
+    if (((v.u >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0) {
+        /* subnormal or zero */
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+    half = sign | (exponent << 10) | (mantissa >> 13);
+    rest = mantissa & 0x1fff;
+    /* carry into exponent gives the right result */
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+/*!
+ * \brief Convert IEEE half precision to float
+ * \param half half precision bits
+ * \return float value
+ */
+static float half_to_float(uint16_t half)
+{
+    union {float f; uint32_t u;} v;
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            v.u = sign;
+            return v.f;
+        }
+        /* normalize subnormal */
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        v.u = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    else if (exponent == 31)
+        v.u = sign | 0x7f800000 | (mantissa << 13);
+    else
+        v.u = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    return v.f;
+}
+
+/*!
+ * \brief Convert float to bfloat16 (upper half of float, rounded)
+ * \param value float value
+ * \return bfloat16 bits
+ */
+static uint16_t float_to_bfloat16(float value)
+{
+    union {float f; uint32_t u;} v;
+
+    v.f = value;
+    if (isnan(value))
+        return (v.u >> 16) | 0x40;
+    return (v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16;
+}
+
+/*!
+ * \brief Convert bfloat16 to float
+ * \param bfloat bfloat16 bits
+ * \return float value
+ */
+static float bfloat16_to_float(uint16_t bfloat)
+{
+    union {float f; uint32_t u;} v;
+
+    v.u = (uint32_t) bfloat << 16;
+    return v.f;
+}
+
+/*!
+ * \brief Set range of values for layer stored as scaled int16
+ *
+ * Values outside of the range are clamped. No effect for other types.
+ *
+ * \param layer layer
+ * \param min minimum value
+ * \param max maximum value
+ */
+void SegmentLayer_set_range(struct SegmentLayer *layer, double min, double max)
+{
+    if (layer->storage != STORE_SCALED_INT16)
+        return;
+    layer->value_offset = (min + max) / 2;
+    layer->value_scale = (max - min) / (2 * INT16_MAX);
+    if (!(layer->value_scale > 0))
+        layer->value_scale = 1;
+}
+
+/*!
+ * \brief Convert stored value to CELL or FCELL
+ * \param layer layer
+ * \param stored stored value
+ * \param[out] value CELL or FCELL value
+ */
+static void decode_value(const struct SegmentLayer *layer, const void *stored, void *value)
+{
+    signed char c;
+    unsigned short u;
+    int16_t s;
+
+    switch (layer->storage) {
+    case STORE_INT8:
+        c = *(const signed char *) stored;
+        if (c == SCHAR_MIN)
+            Rast_set_c_null_value((CELL *) value, 1);
+        else
+            *(CELL *) value = c;
+        break;
+    case STORE_UINT16:
+        u = *(const unsigned short *) stored;
+        if (u == USHRT_MAX)
+            Rast_set_c_null_value((CELL *) value, 1);
+        else
+            *(CELL *) value = u;
+        break;
+    case STORE_QUANTIZED_INT8:
+        c = *(const signed char *) stored;
+        if (c == SCHAR_MIN)
+            Rast_set_f_null_value((FCELL *) value, 1);
+        else
+            *(FCELL *) value = c / (FCELL) SCHAR_MAX;
+        break;
+    case STORE_FLOAT16:
+    case STORE_BFLOAT16:
+        u = *(const uint16_t *) stored;
+        if (u == UINT16_MAX)
+            Rast_set_f_null_value((FCELL *) value, 1);
+        else if (layer->storage == STORE_FLOAT16)
+            *(FCELL *) value = half_to_float(u);
+        else
+            *(FCELL *) value = bfloat16_to_float(u);
+        break;
+    case STORE_SCALED_INT16:
+        s = *(const int16_t *) stored;
+        if (s == INT16_MIN)
+            Rast_set_f_null_value((FCELL *) value, 1);
+        else
+            *(FCELL *) value = layer->value_offset + s * layer->value_scale;
+        break;
+    default:
+        memcpy(value, stored, layer->size);
+    }
+}
+
+/*!
+ * \brief Convert CELL or FCELL value to stored value
+ * \param layer layer
+ * \param value CELL or FCELL value
+ * \param[out] stored stored value
+ */
+static void encode_value(const struct SegmentLayer *layer, const void *value, void *stored)
+{
+    CELL c;
+    FCELL f;
+    double scaled;
+
+    switch (layer->storage) {
+    case STORE_INT8:
+        c = *(const CELL *) value;
+        if (Rast_is_c_null_value(&c))
+            *(signed char *) stored = SCHAR_MIN;
+        else if (c < -SCHAR_MAX || c > SCHAR_MAX)
+            G_fatal_error(_("Value %d does not fit into storage type"), c);
+        else
+            *(signed char *) stored = c;
+        break;
+    case STORE_UINT16:
+        c = *(const CELL *) value;
+        if (Rast_is_c_null_value(&c))
+            *(unsigned short *) stored = USHRT_MAX;
+        else if (c < 0 || c >= USHRT_MAX)
+            G_fatal_error(_("Value %d does not fit into storage type"), c);
+        else
+            *(unsigned short *) stored = c;
+        break;
+    case STORE_QUANTIZED_INT8:
+        f = *(const FCELL *) value;
+        if (Rast_is_f_null_value(&f)) {
+            *(signed char *) stored = SCHAR_MIN;
+            break;
+        }
+        /* weights are from -1 to 1, SCHAR_MIN is NULL */
+        f *= SCHAR_MAX;
+        if (f > SCHAR_MAX)
+            f = SCHAR_MAX;
+        else if (f < -SCHAR_MAX)
+            f = -SCHAR_MAX;
+        *(signed char *) stored = (signed char) lrintf(f);
+        break;
+    case STORE_FLOAT16:
+        f = *(const FCELL *) value;
+        /* values over 65504 become infinity */
+        if (Rast_is_f_null_value(&f))
+            *(uint16_t *) stored = UINT16_MAX;
+        else
+            *(uint16_t *) stored = float_to_half(f);
+        break;
+    case STORE_BFLOAT16:
+        f = *(const FCELL *) value;
+        if (Rast_is_f_null_value(&f))
+            *(uint16_t *) stored = UINT16_MAX;
+        else
+            *(uint16_t *) stored = float_to_bfloat16(f);
+        break;
+    case STORE_SCALED_INT16:
+        f = *(const FCELL *) value;
+        if (Rast_is_f_null_value(&f)) {
+            *(int16_t *) stored = INT16_MIN;
+            break;
+        }
+        scaled = (f - layer->value_offset) / layer->value_scale;
+        if (scaled > INT16_MAX)
+            scaled = INT16_MAX;
+        else if (scaled < -INT16_MAX)
+            scaled = -INT16_MAX;
+        *(int16_t *) stored = (int16_t) lrint(scaled);
+        break;
+    default:
+        memcpy(stored, value, layer->size);
+    }
+}
+
+/*!
+ * \brief Round value as if it was stored in the layer
+ * \param layer layer of FCELL type
+ * \param value value
+ * \return value after storing and reading
+ */
+FCELL SegmentLayer_round(const struct SegmentLayer *layer, FCELL value)
+{
+    char stored[sizeof(FCELL)];
+    FCELL rounded;
+
+    encode_value(layer, &value, stored);
+    decode_value(layer, stored, &rounded);
+    return rounded;
+}
+
+/*!
+ * \brief Update development state of a cell from value of development
+ * \param layer layer of development
+ * \param value pointer to CELL value
+ * \param row row
+ * \param col column
+ */
+static void update_state(struct SegmentLayer *layer, const void *value, int row, int col)
+{
+    const CELL *developed = value;
+
+    if (Rast_is_c_null_value(developed))
+        CellStates_set(layer->states, row, col, STATE_NULL);
+    else if (*developed == -1)
+        CellStates_set(layer->states, row, col, STATE_UNDEVELOPED);
+    else
+        CellStates_set(layer->states, row, col, STATE_DEVELOPED);
+}
+
+/*!
+ * \brief Get next cell in a row which can have data
+ *
+ * Used to skip cells without data in sweeps.
+ *
+ * \param layer layer
+ * \param row row
+ * \param col column to start from (included)
+ * \return column of the next cell or number of columns if there is none
+ */
+int SegmentLayer_next_valid(const struct SegmentLayer *layer, int row, int col)
+{
+    if (layer->store->valid)
+        return ValidCells_next(layer->store->valid, row, col);
+    return col;
+}
+
+/*!
+ * \brief Get value of a layer for a cell
+ *
+ * Cells without data are NULL.
+ *
+ * \param layer layer
+ * \param[out] value pointer to CELL or FCELL based on layer type
+ * \param row row
+ * \param col column
+ */
+void SegmentLayer_get(struct SegmentLayer *layer, void *value, int row, int col)
+{
+    struct CellStore *store = layer->store;
+
+    if (store->valid && !ValidCells_is_valid(store->valid, row, col)) {
+        Rast_set_null_value(value, 1, layer->type);
+        return;
+    }
+
+    if (store->backend != BACKEND_SEGMENT) {
+        decode_value(layer, (char *) TileStore_address(&store->tiles, row, col, false)
+                     + layer->offset, value);
+        return;
+    }
+    if (!layer->shared && layer->storage == STORE_NATIVE) {
+        Segment_get(&store->segment, value, row, col);
+        return;
+    }
+    Segment_get(&store->segment, store->record, row, col);
+    decode_value(layer, (char *) store->record + layer->offset, value);
+}
+
+/*!
+ * \brief Set value of a layer for a cell
+ *
+ * Values of cells without data are ignored.
+ *
+ * \param layer layer
+ * \param value pointer to CELL or FCELL based on layer type
+ * \param row row
+ * \param col column
+ */
+void SegmentLayer_put(struct SegmentLayer *layer, const void *value, int row, int col)
+{
+    struct CellStore *store = layer->store;
+
+    if (store->valid && !ValidCells_is_valid(store->valid, row, col))
+        return;
+    if (layer->states)
+        update_state(layer, value, row, col);
+    if (store->backend != BACKEND_SEGMENT) {
+        encode_value(layer, value, (char *) TileStore_address(&store->tiles, row, col, true)
+                     + layer->offset);
+        return;
+    }
+    if (!layer->shared && layer->storage == STORE_NATIVE) {
+        Segment_put(&store->segment, value, row, col);
+        return;
+    }
+    if (layer->shared)
+        Segment_get(&store->segment, store->record, row, col);
+    encode_value(layer, value, (char *) store->record + layer->offset);
+    Segment_put(&store->segment, store->record, row, col);
+}
+
+/*!
+ * \brief Get row of a layer
+ * \param layer layer
+ * \param[out] buf buffer of CELL or FCELL values
+ * \param row row
+ */
+void SegmentLayer_get_row(struct SegmentLayer *layer, void *buf, int row)
+{
+    int col, cols;
+    size_t size;
+    struct CellStore *store = layer->store;
+
+    cols = Rast_window_cols();
+    size = Rast_cell_size(layer->type);
+    if (!layer->shared && layer->storage == STORE_NATIVE) {
+        store_get_row(store, buf, row);
+    }
+    else {
+        store_get_row(store, store->row, row);
+        for (col = 0; col < cols; col++)
+            decode_value(layer, (char *) store->row + (size_t) col * store->len + layer->offset,
+                         (char *) buf + col * size);
+    }
+    if (store->valid)
+        for (col = 0; col < cols; col++)
+            if (!ValidCells_is_valid(store->valid, row, col))
+                Rast_set_null_value((char *) buf + col * size, 1, layer->type);
+}
+
+/*!
+ * \brief Set row of a layer
+ * \param layer layer
+ * \param buf buffer of CELL or FCELL values
+ * \param row row
+ */
+void SegmentLayer_put_row(struct SegmentLayer *layer, const void *buf, int row)
+{
+    int col, cols;
+    size_t size;
+    struct CellStore *store = layer->store;
+
+    cols = Rast_window_cols();
+    size = Rast_cell_size(layer->type);
+    if (layer->states)
+        for (col = 0; col < cols; col++)
+            if (!store->valid || ValidCells_is_valid(store->valid, row, col))
+                update_state(layer, (const char *) buf + col * size, row, col);
+    if (!layer->shared && layer->storage == STORE_NATIVE) {
+        store_put_row(store, buf, row);
+        return;
+    }
+    if (layer->shared)
+        store_get_row(store, store->row, row);
+    for (col = 0; col < cols; col++)
+        encode_value(layer, (const char *) buf + col * size,
+                     (char *) store->row + (size_t) col * store->len + layer->offset);
+    store_put_row(store, store->row, row);
+}
+
+/*!
+ * \brief Flush segment of a layer
+ * \param layer layer
+ */
+void SegmentLayer_flush(struct SegmentLayer *layer)
+{
+    if (layer->store->backend == BACKEND_SEGMENT)
+        Segment_flush(&layer->store->segment);
+    else
+        TileStore_flush(&layer->store->tiles);
+}
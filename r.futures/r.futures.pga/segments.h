@@ -0,0 +1,123 @@
+#ifndef FUTURES_SEGMENTS_H
+#define FUTURES_SEGMENTS_H
+
+#include <stdbool.h>
+#include <grass/gis.h>
+#include <grass/segment.h>
+
+#include "tilestore.h"
+#include "validcells.h"
+#include "cellstates.h"
+
+struct SegmentMemory
+{
+    int rows;
+    int cols;
+    int in_memory;
+};
+
+enum storage_backend {BACKEND_SEGMENT, BACKEND_MMAP, BACKEND_CACHE};
+
+/* tiled store of fixed-size cell records (one or more layer values) */
+struct CellStore
+{
+    enum storage_backend backend;
+    // description of the content for messages
+    const char *name;
+    SEGMENT segment;
+    // file of the segment (not filled when created)
+    int fd;
+    char *filename;
+    struct TileStore tiles;
+    // cells with data or NULL when not known
+    const struct ValidCells *valid;
+    // size of record in bytes
+    int len;
+    // buffers for one record and one row of records
+    void *record;
+    void *row;
+};
+
+/* how values are stored, CELL and FCELL are stored as they are */
+enum layer_storage {STORE_NATIVE, STORE_INT8, STORE_UINT16, STORE_QUANTIZED_INT8,
+                    STORE_FLOAT16, STORE_BFLOAT16, STORE_SCALED_INT16};
+
+struct SegmentLayer
+{
+    struct CellStore *store;
+    // CELL_TYPE or FCELL_TYPE as seen by the callers
+    RASTER_MAP_TYPE type;
+    enum layer_storage storage;
+    // size of the stored value in bytes
+    int size;
+    // offset of the value in the record
+    int offset;
+    // value = offset + stored * scale (for scaled int16)
+    double value_offset;
+    double value_scale;
+    // store is shared by multiple layers
+    bool shared;
+    // states updated from the values (only for development)
+    struct CellStates *states;
+    bool open;
+};
+
+struct Segments
+{
+    struct SegmentLayer developed;
+    struct SegmentLayer subregions;
+    struct SegmentLayer potential_subregions;
+    struct SegmentLayer devpressure;
+    struct SegmentLayer aggregated_predictor;
+    struct SegmentLayer probability;
+    struct SegmentLayer weight;
+    // store for interleaved layers
+    struct CellStore records;
+    // development state of cells in memory
+    struct CellStates states;
+    bool use_weight;
+    bool use_potential_subregions;
+    bool interleaved;
+    enum storage_backend backend;
+    // cells with data (optional)
+    const struct ValidCells *valid;
+    // tile stores contain only valid cells
+    bool compact;
+    // tile size and number of tiles in memory
+    struct SegmentMemory memory;
+    // not all tiles fit into memory
+    bool limited_memory;
+    // limit of memory used by the simulation in bytes (0 for no limit)
+    size_t memory_limit;
+    // GRASS compressor and memory in bytes for compressed tiles (cache only)
+    int compressor;
+    double compressed_memory;
+    // position of each tile in the files or NULL for rows of tiles
+    size_t *tile_order;
+};
+
+void set_storage_types(struct Segments *segments, int max_steps, int num_regions,
+                       int num_potential_regions, bool quantize_weight,
+                       enum layer_storage float_storage);
+size_t get_segments_cell_size(const struct Segments *segments);
+size_t get_segments_stored_cells(const struct Segments *segments);
+void open_segments(struct Segments *segments, struct SegmentMemory segment_info);
+void close_segments(struct Segments *segments);
+void flush_segments(struct Segments *segments);
+void limit_segments_memory(struct Segments *segments);
+void advise_segments(struct Segments *segments, int row1, int col1, int row2, int col2,
+                     enum tile_advice advice);
+void pin_segments(struct Segments *segments, int row1, int col1, int row2, int col2);
+void unpin_segments(struct Segments *segments);
+void set_segments_scan(struct Segments *segments, bool scan);
+void SegmentLayer_set_scan(struct SegmentLayer *layer, bool scan);
+void SegmentLayer_set_range(struct SegmentLayer *layer, double min, double max);
+FCELL SegmentLayer_round(const struct SegmentLayer *layer, FCELL value);
+int SegmentLayer_next_valid(const struct SegmentLayer *layer, int row, int col);
+void SegmentLayer_get(struct SegmentLayer *layer, void *value, int row, int col);
+void SegmentLayer_put(struct SegmentLayer *layer, const void *value, int row, int col);
+void SegmentLayer_get_row(struct SegmentLayer *layer, void *buf, int row);
+void SegmentLayer_put_row(struct SegmentLayer *layer, const void *buf, int row);
+void SegmentLayer_flush(struct SegmentLayer *layer);
+
+#endif // FUTURES_SEGMENTS_H
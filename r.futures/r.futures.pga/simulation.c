@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <math.h>
 
 #include <grass/gis.h>
@@ -26,6 +27,7 @@
 #include "utils.h"
 #include "simulation.h"
 #include "output.h"
+#include "memusage.h"
 
 /*!
  * \brief Find a seed cell based on cumulative probability.
@@ -39,9 +41,9 @@
  * \param[in] region region index
  * \return index in undev_cells (that's not cell id)
  */
-int find_probable_seed(struct Undeveloped *undev_cells, int region)
+size_t find_probable_seed(struct Undeveloped *undev_cells, int region)
 {
-    int first, last, middle;
+    ptrdiff_t first, last, middle;
     double p;
 
     p = G_drand48();
@@ -77,15 +79,15 @@ int find_probable_seed(struct Undeveloped *undev_cells, int region)
  * \param[out] col column
  * \return index in undev_cells (not id of a cell)
  */
-int get_seed(struct Undeveloped *undev_cells, int region_idx, enum seed_search method,
-              int *row, int *col)
+size_t get_seed(struct Undeveloped *undev_cells, int region_idx, enum seed_search method,
+                int *row, int *col)
 {
-    int i, id;
+    size_t i, id;
     if (method == RANDOM)
-        i = (int)(G_drand48() * undev_cells->num[region_idx]);
+        i = (size_t)(G_drand48() * undev_cells->num[region_idx]);
     else
         i = find_probable_seed(undev_cells, region_idx);
-    id = undev_cells->cells[region_idx][i].id;
+    id = UndevelopedCell_get_id(&undev_cells->cells[region_idx][i]);
     get_xy_from_idx(id, Rast_window_cols(), row, col);
     return i;
 }
@@ -113,10 +115,10 @@ double get_develop_probability_xy(struct Segments *segments,
     FCELL weight;
     CELL pot_index;
 
-    Segment_get(&segments->devpressure, (void *)&devpressure_val, row, col);
-    Segment_get(&segments->aggregated_predictor, (void *)&predictors_val, row, col);
+    SegmentLayer_get(&segments->devpressure, (void *)&devpressure_val, row, col);
+    SegmentLayer_get(&segments->aggregated_predictor, (void *)&predictors_val, row, col);
     if (segments->use_potential_subregions)
-        Segment_get(&segments->potential_subregions, (void *)&pot_index, row, col);
+        SegmentLayer_get(&segments->potential_subregions, (void *)&pot_index, row, col);
     else
         pot_index = region_index;
     
@@ -135,7 +137,7 @@ double get_develop_probability_xy(struct Segments *segments,
     
     /* weights if applicable */
     if (segments->use_weight) {
-        Segment_get(&segments->weight, (void *)&weight, row, col);
+        SegmentLayer_get(&segments->weight, (void *)&weight, row, col);
         if (weight < 0)
             probability *= 1 - fabs(weight);
         else if (weight > 0)
@@ -160,9 +162,8 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
                              struct Potential *potential_info)
 {
     int row, col, cols, rows;
-    int id, i, idx, new_size;
+    size_t id, i, idx, new_size;
     int region_idx;
-    CELL developed;
     CELL region;
     FCELL *values;
     float probability;
@@ -175,38 +176,48 @@ void recompute_probabilities(struct Undeveloped *undeveloped_cells,
     for (region_idx = 0; region_idx < undeveloped_cells->max_subregions; region_idx++) {
         undeveloped_cells->num[region_idx] = 0;
     }
+    set_segments_scan(segments, true);
     for (row = 0; row < rows; row++) {
-        for (col = 0; col < cols; col++) {
-            Segment_get(&segments->developed, (void *)&developed, row, col);
-            if (Rast_is_null_value(&developed, CELL_TYPE))
-                continue;
-            if (developed != -1)
+        /* hint which tiles the sweep needs next and which are done */
+        if (row % segments->memory.rows == 0) {
+            advise_segments(segments, row + segments->memory.rows, 0,
+                            row + 2 * segments->memory.rows - 1, cols - 1, TILES_WILLNEED);
+            if (segments->limited_memory && row > 0)
+                advise_segments(segments, row - segments->memory.rows, 0,
+                                row - 1, cols - 1, TILES_DONTNEED);
+        }
+        for (col = SegmentLayer_next_valid(&segments->developed, row, 0); col < cols;
+             col = SegmentLayer_next_valid(&segments->developed, row, col + 1)) {
+            if (CellStates_get(&segments->states, row, col) != STATE_UNDEVELOPED)
                 continue;
-            Segment_get(&segments->subregions, (void *)&region, row, col);
+            SegmentLayer_get(&segments->subregions, (void *)&region, row, col);
             
             /* realloc if needed */
             if (undeveloped_cells->num[region] >= undeveloped_cells->max[region]) {
                 new_size = 2 * undeveloped_cells->max[region];
                 undeveloped_cells->cells[region] = 
-                        (struct UndevelopedCell *) G_realloc(undeveloped_cells->cells[region],
-                                                             new_size * sizeof(struct UndevelopedCell));
+                        (struct UndevelopedCell *) tracked_realloc(MEMORY_UNDEVELOPED,
+                                                                   undeveloped_cells->cells[region],
+                                                                   new_size * sizeof(struct UndevelopedCell));
                 undeveloped_cells->max[region] = new_size;
+                /* make space by reducing tile cache */
+                limit_segments_memory(segments);
             }
             id = get_idx_from_xy(row, col, cols);
             idx = undeveloped_cells->num[region];
-            undeveloped_cells->cells[region][idx].id = id;
+            UndevelopedCell_set_id(&undeveloped_cells->cells[region][idx], id);
             undeveloped_cells->cells[region][idx].tried = 0;
             /* get probability and update undevs and segment*/
             probability = get_develop_probability_xy(segments, values,
                                                      potential_info, region, row, col);
-            Segment_put(&segments->probability, (void *)&probability, row, col);
+            SegmentLayer_put(&segments->probability, (void *)&probability, row, col);
             undeveloped_cells->cells[region][idx].probability = probability;
             
             undeveloped_cells->num[region]++;
             
         }
     }
-    Segment_flush(&segments->probability);
+    set_segments_scan(segments, false);
 
     i = 0;
     for (region_idx = 0; region_idx < undeveloped_cells->max_subregions; region_idx++) {
@@ -252,7 +263,8 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                   int step, int region, struct KeyValueIntInt *reverse_region_map,
                   bool overgrow)
 {
-    int i, idx;
+    int i;
+    size_t idx;
     int region_id;
     int n_to_convert;
     int n_done;
@@ -260,16 +272,16 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
     int seed_row, seed_col;
     int row, col;
     int patch_size;
-    int *added_ids;
+    int radius;
+    size_t *added_ids;
     bool force_convert_all;
     int extra;
     bool allow_already_tried_ones;
     int unsuccessful_tries;
     FCELL prob;
-    CELL developed;
 
 
-    added_ids = (int *) G_malloc(sizeof(int) * patch_sizes->max_patch_size);
+    added_ids = (size_t *) tracked_malloc(MEMORY_CANDIDATES, sizeof(size_t) * patch_sizes->max_patch_size);
     n_to_convert = demand->table[region][step];
     n_done = 0;
     force_convert_all = false;
@@ -312,13 +324,12 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
         /* mark as tried */
         undev_cells->cells[region][idx].tried = 1;
         /* see if seed was already developed during this time step */
-        Segment_get(&segments->developed, (void *)&developed, seed_row, seed_col);
-        if (developed != -1) {
+        if (CellStates_get(&segments->states, seed_row, seed_col) != STATE_UNDEVELOPED) {
             unsuccessful_tries++;
             continue;
         }
         /* get probability */
-        Segment_get(&segments->probability, (void *)&prob, seed_row, seed_col);
+        SegmentLayer_get(&segments->probability, (void *)&prob, seed_row, seed_col);
         /* challenge probability unless we need to convert all */
         if(force_convert_all || G_drand48() < prob) {
             /* ger random patch size */
@@ -326,6 +337,10 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
             /* last year: we shouldn't grow bigger patches than we have space for */
             if (!overgrow && patch_size + n_done > n_to_convert)
                 patch_size = n_to_convert - n_done;
+            /* keep tiles for the patch and development pressure around it */
+            radius = devpressure_info->neighborhood + (int) sqrt(patch_size) + 1;
+            pin_segments(segments, seed_row - radius, seed_col - radius,
+                         seed_row + radius, seed_col + radius);
             /* grow patch and return the actual grown size which could be smaller */
             found = grow_patch(seed_row, seed_col, patch_size, step, region,
                                patch_info, segments, patch_overflow, added_ids);
@@ -338,13 +353,13 @@ void compute_step(struct Undeveloped *undev_cells, struct Demand *demand,
                 get_xy_from_idx(added_ids[i], Rast_window_cols(), &row, &col);
                 update_development_pressure_precomputed(row, col, segments, devpressure_info);
             }
-            Segment_flush(&segments->devpressure);
+            unpin_segments(segments);
             n_done += found;
         }
     }
     extra += (n_done - n_to_convert);
     patch_overflow[region] = extra;
     G_debug(2, "There are %d extra cells for next timestep", extra);
-    G_free(added_ids);
+    tracked_free(MEMORY_CANDIDATES, added_ids);
 }
 
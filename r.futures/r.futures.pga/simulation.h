@@ -8,8 +8,8 @@
 
 enum seed_search {RANDOM, PROBABILITY};
 
-int find_probable_seed(struct Undeveloped *undev_cells, int region);
-int get_seed(struct Undeveloped *undev_cells, int region_idx, enum seed_search method,
+size_t find_probable_seed(struct Undeveloped *undev_cells, int region);
+size_t get_seed(struct Undeveloped *undev_cells, int region_idx, enum seed_search method,
               int *row, int *col);
 double get_develop_probability_xy(struct Segments *segments,
                                   FCELL *values,
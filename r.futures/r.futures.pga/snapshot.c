@@ -0,0 +1,494 @@
+/*!
+   \file snapshot.c
+
+   \brief Snapshot of preprocessed inputs
+
+   Reading the input rasters, indexing subregions and aggregating
+   predictors gives the same result for all runs with the same inputs
+   and coefficients, e.g., runs with different random seeds.
+   The snapshot stores the result in a binary file which later runs
+   map into memory read-only, so that concurrent runs share one copy
+   through the page cache and don't read the input rasters.
+
+   The file starts with a header with a version, a key computed from
+   the inputs and a checksum, followed by subregion categories,
+   the bitmap of cells with data and all layers of each row.
+   All parts are aligned to 8 bytes.
+   The file is written under a temporary name and renamed when complete,
+   so that runs started at the same time never read a partial snapshot.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "FUTURES"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;
+    // checksum and size of everything after the header
+    uint64_t checksum;
+    uint64_t size;
+    int32_t rows;
+    int32_t cols;
+    int32_t num_regions;
+    int32_t num_potential_regions;
+    int32_t use_weight;
+    int32_t use_potential_subregions;
+};
+
+static size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    return hash;
+}
+
+/*!
+ * \brief Update checksum with data padded by zeros to 8 bytes
+ *
+ * Data are processed by 8 bytes which is much faster than by bytes.
+ */
+static uint64_t checksum_words(uint64_t checksum, const void *data, size_t size)
+{
+    const char *bytes = data;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&word, bytes + i, 8);
+        checksum = (checksum ^ word) * FNV_PRIME;
+    }
+    if (i < size) {
+        word = 0;
+        memcpy(&word, bytes + i, size - i);
+        checksum = (checksum ^ word) * FNV_PRIME;
+    }
+    return checksum;
+}
+
+static uint64_t hash_string(uint64_t hash, const char *string)
+{
+    if (!string)
+        string = "";
+    /* include the terminating zero to separate strings */
+    return hash_bytes(hash, string, strlen(string) + 1);
+}
+
+/*!
+ * \brief Add raster map name, mapset and time and size of its files to hash
+ */
+static uint64_t hash_raster(uint64_t hash, const char *name)
+{
+    const char *elements[] = {"cellhd", "cell", "fcell", "cell_misc"};
+    char path[GPATH_MAX];
+    const char *mapset;
+    struct stat info;
+    int64_t stamp[2];
+    size_t i;
+
+    if (!name)
+        return hash_string(hash, NULL);
+    mapset = G_find_raster2(name, "");
+    if (mapset == NULL)
+        G_fatal_error(_("Raster map <%s> not found"), name);
+    hash = hash_string(hash, name);
+    hash = hash_string(hash, mapset);
+    for (i = 0; i < sizeof(elements) / sizeof(elements[0]); i++) {
+        G_file_name(path, elements[i], name, mapset);
+        stamp[0] = stamp[1] = -1;
+        if (stat(path, &info) == 0) {
+            stamp[0] = info.st_mtime;
+            stamp[1] = info.st_size;
+        }
+        hash = hash_bytes(hash, stamp, sizeof(stamp));
+    }
+    return hash;
+}
+
+/*!
+ * \brief Compute key of a snapshot from inputs
+ *
+ * The key covers the computational region, names and modification
+ * times of the input rasters and of the MASK and the content of
+ * the Potential table,
+ * so a snapshot is recreated whenever any of them changes.
+ *
+ * \param inputs raster inputs
+ * \param num_predictors number of predictors
+ * \param potential_file name of file with Potential table
+ * \param separator separator used in the file
+ * \return key
+ */
+uint64_t get_snapshot_key(struct RasterInputs inputs, int num_predictors,
+                          const char *potential_file, const char *separator)
+{
+    struct Cell_head window;
+    uint64_t hash = FNV_OFFSET;
+    int version = SNAPSHOT_VERSION;
+    double extent[6];
+    int dims[2];
+    int i;
+    char buffer[4096];
+    size_t n;
+    FILE *fp;
+
+    hash = hash_bytes(hash, &version, sizeof(version));
+    G_get_window(&window);
+    extent[0] = window.north;
+    extent[1] = window.south;
+    extent[2] = window.east;
+    extent[3] = window.west;
+    extent[4] = window.ns_res;
+    extent[5] = window.ew_res;
+    dims[0] = window.rows;
+    dims[1] = window.cols;
+    hash = hash_bytes(hash, extent, sizeof(extent));
+    hash = hash_bytes(hash, dims, sizeof(dims));
+
+    hash = hash_raster(hash, inputs.developed);
+    hash = hash_raster(hash, inputs.regions);
+    hash = hash_raster(hash, inputs.potential_regions);
+    hash = hash_raster(hash, inputs.devpressure);
+    hash = hash_raster(hash, inputs.weights);
+    for (i = 0; i < num_predictors; i++)
+        hash = hash_raster(hash, inputs.predictors[i]);
+    /* MASK is applied to all the input rasters when they are read */
+    hash = hash_raster(hash, G_find_raster2("MASK", G_mapset()) ? "MASK" : NULL);
+
+    hash = hash_string(hash, separator);
+    if ((fp = fopen(potential_file, "rb")) == NULL)
+        G_fatal_error(_("Cannot open potential file <%s>"), potential_file);
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        hash = hash_bytes(hash, buffer, n);
+    fclose(fp);
+
+    return hash;
+}
+
+/*!
+ * \brief Set sizes and offsets of parts of the file
+ */
+static void set_layout(struct Snapshot *snapshot)
+{
+    int layers;
+
+    snapshot->valid_offset = align8(sizeof(struct SnapshotHeader))
+            + align8((size_t) (snapshot->num_regions + snapshot->num_potential_regions)
+                     * sizeof(int32_t));
+    snapshot->rows_offset = snapshot->valid_offset
+            + (size_t) snapshot->rows * ((snapshot->cols + 63) / 64) * sizeof(uint64_t);
+    /* developed, subregions, development pressure and aggregated predictors */
+    layers = 4 + snapshot->use_weight + snapshot->use_potential_subregions;
+    snapshot->row_size = layers * align8((size_t) snapshot->cols * sizeof(CELL));
+}
+
+/*!
+ * \brief Open and map existing snapshot if it matches the inputs
+ *
+ * \param snapshot snapshot to open
+ * \param filename file name
+ * \param key key of the inputs from get_snapshot_key()
+ * \param segments segments with use_weight and use_potential_subregions set
+ * \return true if the snapshot can be used, false if it should be created
+ */
+bool Snapshot_open(struct Snapshot *snapshot, const char *filename, uint64_t key,
+                   const struct Segments *segments)
+{
+    struct SnapshotHeader header;
+    struct stat info;
+    int fd;
+    void *map;
+
+    G_zero(snapshot, sizeof(struct Snapshot));
+    snapshot->filename = filename;
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        G_verbose_message(_("Snapshot <%s> does not exist, it will be created"), filename);
+        return false;
+    }
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(header)
+            || read(fd, &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+            || header.version != SNAPSHOT_VERSION || header.byte_order != SNAPSHOT_BYTE_ORDER
+            || header.size + sizeof(header) != (size_t) info.st_size) {
+        close(fd);
+        G_warning(_("File <%s> is not a snapshot of this version, it will be replaced"),
+                  filename);
+        return false;
+    }
+    if (header.key != key || header.rows != Rast_window_rows()
+            || header.cols != Rast_window_cols()
+            || header.use_weight != segments->use_weight
+            || header.use_potential_subregions != segments->use_potential_subregions) {
+        close(fd);
+        G_verbose_message(_("Snapshot <%s> was created from different inputs,"
+                            " it will be replaced"), filename);
+        return false;
+    }
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        G_fatal_error(_("Unable to map snapshot <%s>"), filename);
+    if (checksum_words(FNV_OFFSET, (const char *) map + sizeof(header), header.size)
+            != header.checksum) {
+        munmap(map, info.st_size);
+        G_warning(_("Snapshot <%s> is damaged, it will be replaced"), filename);
+        return false;
+    }
+
+    snapshot->key = key;
+    snapshot->rows = header.rows;
+    snapshot->cols = header.cols;
+    snapshot->use_weight = header.use_weight;
+    snapshot->use_potential_subregions = header.use_potential_subregions;
+    snapshot->num_regions = header.num_regions;
+    snapshot->num_potential_regions = header.num_potential_regions;
+    snapshot->map = map;
+    snapshot->map_size = info.st_size;
+    set_layout(snapshot);
+    G_verbose_message(_("Using snapshot <%s>"), filename);
+    return true;
+}
+
+static void write_data(struct Snapshot *snapshot, const void *data, size_t size)
+{
+    uint64_t zero = 0;
+    size_t padding = align8(size) - size;
+
+    if (fwrite(data, 1, size, snapshot->file) != size
+            || fwrite(&zero, 1, padding, snapshot->file) != padding) {
+        fclose(snapshot->file);
+        unlink(snapshot->temp_name);
+        G_fatal_error(_("Unable to write snapshot <%s>"), snapshot->filename);
+    }
+    snapshot->checksum = checksum_words(snapshot->checksum, data, size);
+    snapshot->size += size + padding;
+}
+
+/*!
+ * \brief Start writing a new snapshot
+ *
+ * Subregion categories (in order of their indices) and valid cells
+ * are written immediately, rows are written by Snapshot_write_row().
+ *
+ * \param snapshot snapshot to create
+ * \param filename file name
+ * \param key key of the inputs from get_snapshot_key()
+ * \param segments segments with use_weight and use_potential_subregions set
+ * \param valid index of valid cells
+ * \param region_map subregion categories to indices
+ * \param potential_region_map potential subregion categories to indices
+ */
+void Snapshot_create(struct Snapshot *snapshot, const char *filename, uint64_t key,
+                     const struct Segments *segments, const struct ValidCells *valid,
+                     const struct KeyValueIntInt *region_map,
+                     const struct KeyValueIntInt *potential_region_map)
+{
+    struct SnapshotHeader header;
+    size_t categories_size;
+    int32_t *categories;
+    int i;
+
+    G_zero(snapshot, sizeof(struct Snapshot));
+    snapshot->filename = filename;
+    snapshot->key = key;
+    snapshot->rows = valid->rows;
+    snapshot->cols = valid->cols;
+    snapshot->use_weight = segments->use_weight;
+    snapshot->use_potential_subregions = segments->use_potential_subregions;
+    snapshot->num_regions = region_map->nitems;
+    snapshot->num_potential_regions =
+            segments->use_potential_subregions ? potential_region_map->nitems : 0;
+    set_layout(snapshot);
+
+    snapshot->temp_name = G_malloc(strlen(filename) + 32);
+    sprintf(snapshot->temp_name, "%s.%d.tmp", filename, (int) getpid());
+    snapshot->file = fopen(snapshot->temp_name, "wb");
+    if (!snapshot->file)
+        G_fatal_error(_("Unable to create snapshot <%s>"), filename);
+    /* header is written when the snapshot is complete */
+    G_zero(&header, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, snapshot->file) != 1)
+        G_fatal_error(_("Unable to write snapshot <%s>"), filename);
+    snapshot->checksum = FNV_OFFSET;
+
+    /* keys are stored in order of indices */
+    categories_size = (size_t) (snapshot->num_regions + snapshot->num_potential_regions)
+            * sizeof(int32_t);
+    categories = G_malloc(categories_size + 1);
+    for (i = 0; i < snapshot->num_regions; i++)
+        categories[i] = region_map->key[i];
+    for (i = 0; i < snapshot->num_potential_regions; i++)
+        categories[snapshot->num_regions + i] = potential_region_map->key[i];
+    write_data(snapshot, categories, categories_size);
+    G_free(categories);
+    write_data(snapshot, valid->bits, (size_t) valid->rows * valid->words * sizeof(uint64_t));
+}
+
+/*!
+ * \brief Write rows of all layers to snapshot
+ *
+ * Rows must be written in order.
+ *
+ * \param snapshot snapshot being created
+ * \param input_rows rows of inputs as stored in segments
+ */
+void Snapshot_write_row(struct Snapshot *snapshot, const struct InputRows *input_rows)
+{
+    size_t size = (size_t) snapshot->cols * sizeof(CELL);
+
+    write_data(snapshot, input_rows->developed, size);
+    write_data(snapshot, input_rows->subregions, size);
+    if (snapshot->use_potential_subregions)
+        write_data(snapshot, input_rows->potential_subregions, size);
+    write_data(snapshot, input_rows->devpressure, size);
+    if (snapshot->use_weight)
+        write_data(snapshot, input_rows->weights, size);
+    write_data(snapshot, input_rows->aggregated_predictor, size);
+}
+
+/*!
+ * \brief Get subregion indices from snapshot
+ * \param snapshot opened snapshot
+ * \param[out] region_map subregion categories to indices
+ * \param[out] reverse_region_map subregion indices to categories
+ * \param[out] potential_region_map potential subregion categories to indices
+ */
+void Snapshot_get_regions(const struct Snapshot *snapshot, struct KeyValueIntInt *region_map,
+                          struct KeyValueIntInt *reverse_region_map,
+                          struct KeyValueIntInt *potential_region_map)
+{
+    const int32_t *categories = (const int32_t *) (snapshot->map
+                                                   + align8(sizeof(struct SnapshotHeader)));
+    int i;
+
+    for (i = 0; i < snapshot->num_regions; i++) {
+        KeyValueIntInt_set(region_map, categories[i], i);
+        KeyValueIntInt_set(reverse_region_map, i, categories[i]);
+    }
+    categories += snapshot->num_regions;
+    for (i = 0; i < snapshot->num_potential_regions; i++)
+        KeyValueIntInt_set(potential_region_map, categories[i], i);
+}
+
+/*!
+ * \brief Get valid cells from snapshot
+ * \param snapshot opened snapshot
+ * \param valid created index of valid cells to fill in (not indexed yet)
+ */
+void Snapshot_get_valid_cells(const struct Snapshot *snapshot, struct ValidCells *valid)
+{
+    memcpy(valid->bits, snapshot->map + snapshot->valid_offset,
+           (size_t) valid->rows * valid->words * sizeof(uint64_t));
+}
+
+/*!
+ * \brief Get rows of all layers from snapshot
+ *
+ * Rows point into the mapped file, they are valid until the snapshot is closed.
+ *
+ * \param snapshot opened snapshot
+ * \param row row
+ * \param[out] input_rows rows of inputs as stored in segments
+ */
+void Snapshot_get_row(const struct Snapshot *snapshot, int row, struct InputRows *input_rows)
+{
+    size_t size = align8((size_t) snapshot->cols * sizeof(CELL));
+    const char *data = snapshot->map + snapshot->rows_offset + row * snapshot->row_size;
+
+    input_rows->developed = (const CELL *) data;
+    data += size;
+    input_rows->subregions = (const CELL *) data;
+    data += size;
+    input_rows->potential_subregions = NULL;
+    if (snapshot->use_potential_subregions) {
+        input_rows->potential_subregions = (const CELL *) data;
+        data += size;
+    }
+    input_rows->devpressure = (const FCELL *) data;
+    data += size;
+    input_rows->weights = NULL;
+    if (snapshot->use_weight) {
+        input_rows->weights = (const FCELL *) data;
+        data += size;
+    }
+    input_rows->aggregated_predictor = (const FCELL *) data;
+}
+
+/*!
+ * \brief Finish writing snapshot or unmap snapshot which was read
+ * \param snapshot snapshot
+ */
+void Snapshot_close(struct Snapshot *snapshot)
+{
+    struct SnapshotHeader header;
+
+    if (snapshot->map) {
+        munmap((void *) snapshot->map, snapshot->map_size);
+        snapshot->map = NULL;
+        return;
+    }
+    if (!snapshot->file)
+        return;
+    G_zero(&header, sizeof(header));
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.key = snapshot->key;
+    header.checksum = snapshot->checksum;
+    header.size = snapshot->size;
+    header.rows = snapshot->rows;
+    header.cols = snapshot->cols;
+    header.num_regions = snapshot->num_regions;
+    header.num_potential_regions = snapshot->num_potential_regions;
+    header.use_weight = snapshot->use_weight;
+    header.use_potential_subregions = snapshot->use_potential_subregions;
+    if (fseek(snapshot->file, 0, SEEK_SET) != 0
+            || fwrite(&header, sizeof(header), 1, snapshot->file) != 1
+            || fclose(snapshot->file) != 0) {
+        unlink(snapshot->temp_name);
+        G_fatal_error(_("Unable to write snapshot <%s>"), snapshot->filename);
+    }
+    snapshot->file = NULL;
+    if (rename(snapshot->temp_name, snapshot->filename) != 0) {
+        unlink(snapshot->temp_name);
+        G_fatal_error(_("Unable to create snapshot <%s>"), snapshot->filename);
+    }
+    G_free(snapshot->temp_name);
+    G_verbose_message(_("Snapshot <%s> created"), snapshot->filename);
+}
@@ -0,0 +1,54 @@
+#ifndef FUTURES_SNAPSHOT_H
+#define FUTURES_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "inputs.h"
+#include "keyvalue.h"
+#include "segments.h"
+#include "validcells.h"
+
+struct Snapshot
+{
+    const char *filename;
+    // hash of inputs and coefficients the snapshot was created from
+    uint64_t key;
+    int rows;
+    int cols;
+    bool use_weight;
+    bool use_potential_subregions;
+    int num_regions;
+    int num_potential_regions;
+    // offsets of parts of the file and size of all layers of one row in bytes
+    size_t valid_offset;
+    size_t rows_offset;
+    size_t row_size;
+    // file being written and checksum of what was written so far
+    FILE *file;
+    char *temp_name;
+    uint64_t checksum;
+    size_t size;
+    // mapped snapshot being read
+    const char *map;
+    size_t map_size;
+};
+
+uint64_t get_snapshot_key(struct RasterInputs inputs, int num_predictors,
+                          const char *potential_file, const char *separator);
+bool Snapshot_open(struct Snapshot *snapshot, const char *filename, uint64_t key,
+                   const struct Segments *segments);
+void Snapshot_create(struct Snapshot *snapshot, const char *filename, uint64_t key,
+                     const struct Segments *segments, const struct ValidCells *valid,
+                     const struct KeyValueIntInt *region_map,
+                     const struct KeyValueIntInt *potential_region_map);
+void Snapshot_write_row(struct Snapshot *snapshot, const struct InputRows *input_rows);
+void Snapshot_get_regions(const struct Snapshot *snapshot, struct KeyValueIntInt *region_map,
+                          struct KeyValueIntInt *reverse_region_map,
+                          struct KeyValueIntInt *potential_region_map);
+void Snapshot_get_valid_cells(const struct Snapshot *snapshot, struct ValidCells *valid);
+void Snapshot_get_row(const struct Snapshot *snapshot, int row, struct InputRows *input_rows);
+void Snapshot_close(struct Snapshot *snapshot);
+
+#endif // FUTURES_SNAPSHOT_H
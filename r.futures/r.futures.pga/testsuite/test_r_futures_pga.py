@@ -1,5 +1,10 @@
 #!/usr/bin/env python3
 
+import os
+import shutil
+import tempfile
+import unittest
+
 from grass.gunittest.case import TestCase
 from grass.gunittest.main import test
 
@@ -39,6 +44,20 @@ class TestPGA(TestCase):
     def tearDown(self):
         self.runModule('g.remove', flags='f', type='raster', name=self.output)
 
+    def pga_params(self, **kwargs):
+        """Parameters of the run in test_pga_run updated by kwargs"""
+        params = dict(developed='urban_2002', development_pressure='devpressure',
+                      compactness_mean=0.4, compactness_range=0.05, discount_factor=0.1,
+                      patch_sizes='data/patches.txt',
+                      predictors=['slope', 'lakes_dist_km', 'streets_dist_km'],
+                      n_dev_neighbourhood=15, devpot_params='data/potential.csv',
+                      random_seed=1,
+                      num_neighbors=4, seed_search='random', development_pressure_approach='gravity',
+                      gamma=1.5, scaling_factor=1, subregions='zipcodes',
+                      demand='data/demand.csv', output=self.output)
+        params.update(kwargs)
+        return params
+
     def test_pga_run(self):
         """Test if results is in expected limits"""
         self.assertModule('r.futures.pga', developed='urban_2002', development_pressure='devpressure',
@@ -65,5 +84,162 @@ class TestPGA(TestCase):
                           demand='data/demand.csv', output=self.output)
         self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=1e-6)
 
+    def test_pga_run_patch_cache(self):
+        """Test if results are the same when creating and loading a binary copy of patch library"""
+        cache = self.__class__.__name__ + '_patch_cache'
+        reference = 'patch_cache_reference'
+        for patches in ('data/patches.txt', 'data/patches.csv'):
+            self.assertModule('r.futures.pga', overwrite=True,
+                              **self.pga_params(patch_sizes=patches, output=reference))
+            # the first run creates the copy, the second one loads it
+            for i in range(2):
+                self.assertModule('r.futures.pga', overwrite=True,
+                                  **self.pga_params(patch_sizes=patches, patch_sizes_cache=cache))
+                self.assertRastersNoDifference(actual=self.output, reference=reference, precision=0)
+            os.remove(cache)
+        self.runModule('g.remove', flags='f', type='raster', name=reference)
+
+    def test_pga_run_interleaved(self):
+        """Test if interleaved storage gives the same results"""
+        self.assertModule('r.futures.pga', flags='i', **self.pga_params(memory=0.01))
+        self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=1e-6)
+
+    def test_pga_run_snapshot(self):
+        """Test if results are the same when creating and using a snapshot"""
+        snapshot = self.__class__.__name__ + '_snapshot'
+        for i in range(2):
+            self.assertModule('r.futures.pga', overwrite=True, **self.pga_params(snapshot=snapshot))
+            self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=1e-6)
+        os.remove(snapshot)
+
+    def test_pga_run_snapshot_mask(self):
+        """Test if snapshot is recreated when MASK changes"""
+        snapshot = self.__class__.__name__ + '_snapshot_mask'
+        mask = 'pga_mask'
+        reference = 'mask_reference'
+        self.assertModule('r.futures.pga', **self.pga_params(snapshot=snapshot))
+        self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=0)
+        self.runModule('r.mapcalc', expression='{m} = if(row() % 97 < 20, null(), 1)'.format(m=mask))
+        self.runModule('r.mask', raster=mask)
+        try:
+            self.assertModule('r.futures.pga', **self.pga_params(output=reference))
+            self.assertModule('r.futures.pga', overwrite=True, **self.pga_params(snapshot=snapshot))
+            self.assertRastersNoDifference(actual=self.output, reference=reference, precision=0)
+        finally:
+            self.runModule('r.mask', flags='r')
+            self.runModule('g.remove', flags='f', type='raster', name=[mask, reference])
+            os.remove(snapshot)
+
+    def test_pga_run_deferred_series(self):
+        """Test if series written at the end or as reclass is the same as series written after each step"""
+        num_steps = 3
+        for basename, flags in (('series', ''), ('series_deferred', 'd'), ('series_reclass', 'c')):
+            self.assertModule('r.futures.pga', flags=flags,
+                              **self.pga_params(num_steps=num_steps, output_series=basename))
+        names = []
+        for step in range(1, num_steps + 1):
+            for basename in ('series_deferred', 'series_reclass'):
+                self.assertRastersNoDifference(actual='{}_{}'.format(basename, step),
+                                               reference='series_{}'.format(step), precision=0)
+                names.append('{}_{}'.format(basename, step))
+            names.append('series_{}'.format(step))
+        self.runModule('g.remove', flags='f', type='raster', name=names)
+
+    def test_pga_run_event_log(self):
+        """Test if output recreated from event log is the same as the output"""
+        event_log = self.__class__.__name__ + '_events'
+        rebuilt = 'rebuilt'
+        self.assertModule('r.futures.pga', **self.pga_params(event_log=event_log))
+        self.assertModule('r.futures.events', input=event_log, developed='urban_2002', output=rebuilt)
+        self.assertRastersNoDifference(actual=rebuilt, reference=self.output, precision=0)
+        self.runModule('g.remove', flags='f', type='raster', name=rebuilt)
+        os.remove(event_log)
+
+    @unittest.skipUnless(shutil.which('r.in.gdal'), "GRASS GIS compiled without GDAL")
+    def test_pga_run_geotiff(self):
+        """Test if GeoTIFF copies of the output and the series are the same as the raster maps"""
+        directory = tempfile.mkdtemp()
+        num_steps = 2
+        names = [self.output] + ['geotiff_series_{}'.format(step) for step in range(1, num_steps + 1)]
+        self.assertModule('r.futures.pga', **self.pga_params(num_steps=num_steps, output_series='geotiff_series',
+                                                              geotiff_directory=directory))
+        for name in names:
+            self.assertModule('r.in.gdal', flags='o', input=os.path.join(directory, name + '.tif'),
+                              output=name + '_imported')
+            self.assertRastersNoDifference(actual=name + '_imported', reference=name, precision=0)
+        self.runModule('g.remove', flags='f', type='raster',
+                       name=names[1:] + [name + '_imported' for name in names])
+        shutil.rmtree(directory)
+
+    def test_pga_run_predictor_changes(self):
+        """Test if replaced predictors change results and NULLs in them keep the value in effect"""
+        changes = self.__class__.__name__ + '_changes.csv'
+        reference = 'changes_reference'
+        changed = 'changes_changed'
+
+        def run(lines, output):
+            with open(changes, 'w') as csv:
+                csv.write('year,predictor,raster\n')
+                csv.writelines(line + '\n' for line in lines)
+            self.assertModule('r.futures.pga', overwrite=True,
+                              **self.pga_params(predictor_changes=changes, output=output))
+
+        self.runModule('r.mapcalc', expression='slope_copy = slope')
+        self.runModule('r.mapcalc', expression='slope_holes = if(row() % 50 < 25, null(), slope)')
+        # replacement with the same values
+        run(['2004,slope,slope_copy'], self.output)
+        self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=0)
+        # real replacement
+        run(['2006,slope,lakes_dist_km'], reference)
+        self.runModule('r.mapcalc', expression='{c} = if(isnull({r}) || isnull({o}), 0, {r} != {o})'.format(
+            c=changed, r=reference, o=self.result))
+        self.assertRasterFitsUnivar(raster=changed, reference=dict(max=1), precision=0)
+        # the value from the original is kept where slope_holes is NULL
+        run(['2005,slope,slope_holes', '2006,slope,lakes_dist_km'], self.output)
+        self.assertRastersNoDifference(actual=self.output, reference=reference, precision=0)
+        self.runModule('g.remove', flags='f', type='raster',
+                       name=['slope_copy', 'slope_holes', reference, changed])
+        os.remove(changes)
+
+    def test_pga_run_quantized_weight(self):
+        """Test if weights stored in 1 byte give the same results for weights on the 1/127 grid"""
+        weights = 'weights'
+        reference = 'weights_reference'
+        self.runModule('r.mapcalc', expression='{w} = if(row() % 2, 1.01, round(col() % 255 - 127) / 127.)'.format(w=weights))
+        self.runModule('r.mapcalc', expression='{w}_exact = if({w} > 1, 1, {w})'.format(w=weights))
+        self.assertModule('r.futures.pga', flags='w', **self.pga_params(potential_weight=weights))
+        self.assertModule('r.futures.pga', **self.pga_params(potential_weight=weights + '_exact', output=reference))
+        self.assertRastersNoDifference(actual=self.output, reference=reference, precision=0)
+        self.runModule('g.remove', flags='f', type='raster', name=[weights, weights + '_exact', reference])
+
+    def test_pga_run_mmap(self):
+        """Test if memory-mapped tiles give the same results as segment library"""
+        self.assertModule('r.futures.pga', **self.pga_params(storage='mmap', memory=0.01))
+        self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=0)
+
+    def test_pga_run_cache(self):
+        """Test if tile cache with limited memory gives the same results as segment library"""
+        self.assertModule('r.futures.pga', **self.pga_params(storage='cache', memory=0.005))
+        self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=0)
+
+    def test_pga_run_compressed_tiles(self):
+        """Test if tiles kept compressed in memory give the same results as segment library"""
+        self.assertModule('r.futures.pga', **self.pga_params(storage='cache', memory=0.005,
+                                                              compressed_memory=0.002, flush='step'))
+        self.assertRastersNoDifference(actual=self.output, reference=self.result, precision=0)
+
+    def test_pga_run_compact(self):
+        """Test if storing only cells with data gives the same results as segment library"""
+        developed = 'urban_irregular'
+        reference = 'irregular_reference'
+        self.runModule('r.mapcalc', expression='{d} = if(row() < col() / 2 || row() % 97 < 20, null(), urban_2002)'.format(d=developed))
+        self.assertModule('r.futures.pga', **self.pga_params(developed=developed, output=reference))
+        self.assertModule('r.futures.pga', **self.pga_params(developed=developed, storage='mmap', memory=0.01))
+        self.assertRastersNoDifference(actual=self.output, reference=reference, precision=0)
+        self.assertModule('r.futures.pga', flags='r', overwrite=True,
+                          **self.pga_params(developed=developed, storage='cache', memory=0.005))
+        self.assertRastersNoDifference(actual=self.output, reference=reference, precision=0)
+        self.runModule('g.remove', flags='f', type='raster', name=[developed, reference])
+
 if __name__ == '__main__':
     test()
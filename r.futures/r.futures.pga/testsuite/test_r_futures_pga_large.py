@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+
+import os
+import unittest
+
+from grass.gunittest.case import TestCase
+from grass.gunittest.main import test
+
+
+@unittest.skipUnless(os.environ.get('FUTURES_TEST_LARGE'),
+                     "large window test takes long, set FUTURES_TEST_LARGE to run it")
+class TestPGALargeWindow(TestCase):
+    """Test region with more than 2^31 cells
+
+    Only a corner of the region has data, so cell ids
+    of all developed and undeveloped cells are above 2^31.
+    """
+
+    output = 'pga_large_output'
+
+    @classmethod
+    def setUpClass(cls):
+        cls.use_temp_region()
+        # 47000 x 47000 cells
+        cls.runModule('g.region', n=47000, s=0, e=47000, w=0, res=1)
+        cls.runModule('r.mapcalc',
+            expression="large_developed = if(row() > 46900 && col() > 46900, if(row() > 46980, 1, 0), null())")
+        cls.runModule('r.mapcalc', expression="large_regions = if(isnull(large_developed), null(), 1)")
+        cls.runModule('r.mapcalc', expression="large_devpressure = if(isnull(large_developed), null(), 0.)")
+        cls.runModule('r.mapcalc', expression="large_distance = if(isnull(large_developed), null(), float(46980 - row()))")
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.runModule('g.remove', flags='f', type='raster',
+                      name=['large_developed', 'large_regions', 'large_devpressure',
+                            'large_distance'])
+        cls.del_temp_region()
+
+    def tearDown(self):
+        self.runModule('g.remove', flags='f', type='raster', name=self.output)
+
+    def test_pga_run_large_window(self):
+        """Test that cells with ids above 2^31 are developed"""
+        self.assertModule('r.futures.pga', developed='large_developed',
+                          development_pressure='large_devpressure',
+                          compactness_mean=0.4, compactness_range=0.05, discount_factor=0.1,
+                          patch_sizes='data/patches.txt', predictors='large_distance',
+                          n_dev_neighbourhood=5, devpot_params='data/potential_large.csv',
+                          random_seed=1, storage='cache', memory=1,
+                          num_neighbors=4, seed_search='probability',
+                          development_pressure_approach='gravity',
+                          gamma=1.5, scaling_factor=1, subregions='large_regions',
+                          demand='data/demand_large.csv', output=self.output)
+        # developed in both steps, no cells outside of the corner
+        self.assertRasterMinMax(map=self.output, refmin=-1, refmax=2)
+        self.assertRasterFitsUnivar(raster=self.output, reference=dict(n=10000, max=2),
+                                    precision=0)
+
+
+if __name__ == '__main__':
+    test()
@@ -0,0 +1,886 @@
+/*!
+   \file tilestore.c
+
+   \brief Tiled storage of raster cells in a temporary file
+
+   Cells are stored tile by tile in a temporary file which is either
+   mapped into memory, so the kernel page cache takes care of caching
+   and writing the tiles, or a limited number of tiles is cached here.
+   The simulation can give hints which tiles it is going to need soon
+   and which are not needed anymore.
+
+   The cache uses segmented LRU: new tiles are probationary and become
+   protected only when accessed again, so a sweep over all tiles
+   (which is marked as scan and doesn't promote tiles) evicts only
+   probationary tiles. Tiles around a growing patch can be pinned.
+   Evicted tiles can be compressed and kept in memory, so they are
+   written to the file only when the compressed tiles don't fit either.
+
+   With an index of valid cells, tiles contain only the valid cells
+   and are stored one after another without gaps, so the file size
+   depends on the size of the study area, not the region.
+   Tiles are stored by rows of tiles unless another order is given.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include <grass/gis.h>
+#include <grass/glocale.h>
+
+#include "tilestore.h"
+#include "memusage.h"
+
+#define PROBATION 0
+#define PROTECTED 1
+/* fraction of cache for protected tiles */
+#define PROTECTED_FRACTION 0.8
+
+/*!
+ * \brief Get number of cells stored in a tile with only valid cells
+ * \param tiles tile store
+ * \param tile tile index
+ * \return number of cells
+ */
+static size_t get_tile_cells(const struct TileStore *tiles, size_t tile)
+{
+    return tiles->valid->tile_offset[tile + 1] - tiles->valid->tile_offset[tile];
+}
+
+/*!
+ * \brief Create tile store in a new temporary file
+ *
+ * The file is sparse, so tiles take space only after they are written.
+ * Cached tiles which were never written are not read from the file.
+ * When cache_tiles is 0, the whole file is mapped into memory,
+ * otherwise up to cache_tiles tiles are kept in memory.
+ *
+ * \param tiles tile store
+ * \param filename name of the new (temporary) file
+ * \param rows number of rows
+ * \param cols number of columns
+ * \param tile_rows number of rows in a tile
+ * \param tile_cols number of columns in a tile
+ * \param len size of a cell in bytes
+ * \param cache_tiles number of tiles cached in memory or 0 to map the file
+ * \param valid index of valid cells with the same tiles to store only
+ * valid cells or NULL to store all cells
+ * \param order position of each tile in the file or NULL for tiles by rows
+ */
+void TileStore_open(struct TileStore *tiles, const char *filename,
+                    int rows, int cols, int tile_rows, int tile_cols, int len,
+                    int cache_tiles, const struct ValidCells *valid, const size_t *order)
+{
+    size_t i;
+    size_t page_size;
+    size_t *tile_at;
+
+    tiles->rows = rows;
+    tiles->cols = cols;
+    tiles->tile_rows = tile_rows;
+    tiles->tile_cols = tile_cols;
+    tiles->len = len;
+    tiles->ntile_rows = (rows + tile_rows - 1) / tile_rows;
+    tiles->ntile_cols = (cols + tile_cols - 1) / tile_cols;
+    tiles->ntiles = (size_t) tiles->ntile_rows * tiles->ntile_cols;
+    tiles->tile_size = (size_t) tile_rows * tile_cols * len;
+    /* align tiles to pages so that hints can be given per tile */
+    page_size = sysconf(_SC_PAGESIZE);
+    tiles->tile_stride = (tiles->tile_size + page_size - 1) / page_size * page_size;
+    tiles->map_size = tiles->ntiles * tiles->tile_stride;
+    tiles->valid = valid;
+    if (valid) {
+        if (valid->tile_rows != tile_rows || valid->tile_cols != tile_cols
+                || valid->rows != rows || valid->cols != cols)
+            G_fatal_error(_("Index of valid cells doesn't match the tiles"));
+        tiles->map_size = valid->count * len;
+        /* nothing to map when there are no cells */
+        if (tiles->map_size == 0)
+            tiles->map_size = page_size;
+    }
+    /* compact tiles are stored without gaps, others at page aligned offsets */
+    tiles->offset = tracked_malloc(MEMORY_TILES, tiles->ntiles * sizeof(size_t));
+    tile_at = tracked_malloc(MEMORY_TILES, tiles->ntiles * sizeof(size_t));
+    for (i = 0; i < tiles->ntiles; i++)
+        tile_at[order ? order[i] : i] = i;
+    tiles->offset[tile_at[0]] = 0;
+    for (i = 1; i < tiles->ntiles; i++)
+        tiles->offset[tile_at[i]] = tiles->offset[tile_at[i - 1]]
+                + (valid ? get_tile_cells(tiles, tile_at[i - 1]) * len : tiles->tile_stride);
+    tracked_free(MEMORY_TILES, tile_at);
+
+    tiles->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (tiles->fd < 0)
+        G_fatal_error(_("Cannot create temporary file <%s>"), filename);
+    /* file is removed when closed */
+    unlink(filename);
+    if (ftruncate(tiles->fd, tiles->map_size) != 0)
+        G_fatal_error(_("Cannot allocate temporary file of %lu bytes"),
+                      (unsigned long) tiles->map_size);
+    tiles->hits = tiles->misses = tiles->writes = 0;
+    tiles->packs = tiles->unpacks = tiles->spills = 0;
+    tiles->prefetches = 0;
+    tiles->raw_bytes = tiles->packed_total = 0;
+    tiles->scan = false;
+    tiles->compressor = 0;
+    if (cache_tiles <= 0) {
+        tiles->cache = NULL;
+        tiles->map = mmap(NULL, tiles->map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, tiles->fd, 0);
+        if (tiles->map == MAP_FAILED)
+            G_fatal_error(_("Cannot map temporary file of %lu bytes into memory"),
+                          (unsigned long) tiles->map_size);
+        return;
+    }
+    tiles->map = NULL;
+    if ((size_t) cache_tiles > tiles->ntiles)
+        cache_tiles = tiles->ntiles;
+    tiles->nslots = cache_tiles;
+    tiles->nused = 0;
+    tiles->cache = tracked_malloc(MEMORY_TILES, tiles->nslots * tiles->tile_size);
+    tiles->slots = tracked_calloc(MEMORY_TILES, tiles->nslots, sizeof(struct TileSlot));
+    tiles->tile_slot = tracked_malloc(MEMORY_TILES, tiles->ntiles * sizeof(int));
+    tiles->written = tracked_calloc(MEMORY_TILES, tiles->ntiles, sizeof(bool));
+    for (i = 0; i < tiles->ntiles; i++)
+        tiles->tile_slot[i] = -1;
+    tiles->head[PROBATION] = tiles->tail[PROBATION] = -1;
+    tiles->head[PROTECTED] = tiles->tail[PROTECTED] = -1;
+    tiles->nprotected = 0;
+    tiles->npinned = 0;
+    tiles->pin_limited = false;
+    tiles->last_tile = tiles->ntiles;
+    tiles->last_slot = -1;
+}
+
+/*!
+ * \brief Keep evicted tiles compressed in memory
+ *
+ * Tiles evicted from the cache are compressed and written to the file
+ * only when the compressed tiles exceed the limit (least recently
+ * compressed first). Has effect only for cached tiles.
+ *
+ * \param tiles tile store
+ * \param compressor GRASS compressor number
+ * \param limit maximum size of compressed tiles in bytes
+ */
+void TileStore_set_compression(struct TileStore *tiles, int compressor, size_t limit)
+{
+    if (tiles->map || compressor <= 0 || limit == 0)
+        return;
+    tiles->compressor = compressor;
+    tiles->packed_limit = limit;
+    tiles->packed_bytes = 0;
+    tiles->packed = tracked_calloc(MEMORY_COMPRESSED_TILES, tiles->ntiles,
+                                   sizeof(unsigned char *));
+    tiles->packed_size = tracked_calloc(MEMORY_COMPRESSED_TILES, tiles->ntiles, sizeof(int));
+    tiles->packed_dirty = tracked_calloc(MEMORY_COMPRESSED_TILES, tiles->ntiles, sizeof(bool));
+    tiles->packed_prev = tracked_malloc(MEMORY_COMPRESSED_TILES, tiles->ntiles * sizeof(size_t));
+    tiles->packed_next = tracked_malloc(MEMORY_COMPRESSED_TILES, tiles->ntiles * sizeof(size_t));
+    tiles->packed_head = tiles->packed_tail = tiles->ntiles;
+    tiles->packed_buffer = tracked_malloc(MEMORY_COMPRESSED_TILES,
+                                          G_compress_bound(tiles->tile_size, compressor));
+    tiles->spill_buffer = tracked_malloc(MEMORY_COMPRESSED_TILES, tiles->tile_size);
+}
+
+/*!
+ * \brief Close and remove tile store
+ * \param tiles tile store
+ */
+void TileStore_close(struct TileStore *tiles)
+{
+    size_t i;
+
+    tracked_free(MEMORY_TILES, tiles->offset);
+    if (tiles->map) {
+        munmap(tiles->map, tiles->map_size);
+        tiles->map = NULL;
+    }
+    else {
+        tracked_free(MEMORY_TILES, tiles->cache);
+        tracked_free(MEMORY_TILES, tiles->slots);
+        tracked_free(MEMORY_TILES, tiles->tile_slot);
+        tracked_free(MEMORY_TILES, tiles->written);
+    }
+    if (tiles->compressor) {
+        for (i = 0; i < tiles->ntiles; i++)
+            tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed[i]);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed_size);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed_dirty);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed_prev);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed_next);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed_buffer);
+        tracked_free(MEMORY_COMPRESSED_TILES, tiles->spill_buffer);
+        tiles->compressor = 0;
+    }
+    close(tiles->fd);
+}
+
+/*!
+ * \brief Get position of a tile in the file
+ * \param tiles tile store
+ * \param tile tile index
+ * \return offset in bytes
+ */
+static size_t tile_start(const struct TileStore *tiles, size_t tile)
+{
+    return tiles->offset[tile];
+}
+
+/*!
+ * \brief Get position after the end of a tile in the file
+ * \param tiles tile store
+ * \param tile tile index
+ * \return offset in bytes
+ */
+static size_t tile_end(const struct TileStore *tiles, size_t tile)
+{
+    if (tiles->valid)
+        return tiles->offset[tile] + get_tile_cells(tiles, tile) * tiles->len;
+    return tiles->offset[tile] + tiles->tile_size;
+}
+
+/*!
+ * \brief Read or write tile data
+ * \param tiles tile store
+ * \param tile tile index
+ * \param data tile data
+ * \param write write the tile to file instead of reading it
+ */
+static void transfer_tile(struct TileStore *tiles, size_t tile, char *data, bool write)
+{
+    off_t offset = tile_start(tiles, tile);
+    size_t size = tile_end(tiles, tile) - offset;
+    size_t done = 0;
+    ssize_t ret;
+
+    /* new tiles are all zeros */
+    if (!write && !tiles->written[tile]) {
+        memset(data, 0, size);
+        return;
+    }
+    if (write)
+        tiles->written[tile] = true;
+    while (done < size) {
+        if (write)
+            ret = pwrite(tiles->fd, data + done, size - done, offset + done);
+        else
+            ret = pread(tiles->fd, data + done, size - done, offset + done);
+        if (ret < 0)
+            G_fatal_error(_("Unable to %s tile in temporary file"), write ? "write" : "read");
+        /* end of file (cannot happen for sparse file of the full size) */
+        if (ret == 0) {
+            memset(data + done, 0, size - done);
+            break;
+        }
+        done += ret;
+    }
+}
+
+static void packed_remove(struct TileStore *tiles, size_t tile)
+{
+    size_t prev = tiles->packed_prev[tile];
+    size_t next = tiles->packed_next[tile];
+
+    if (prev < tiles->ntiles)
+        tiles->packed_next[prev] = next;
+    else
+        tiles->packed_head = next;
+    if (next < tiles->ntiles)
+        tiles->packed_prev[next] = prev;
+    else
+        tiles->packed_tail = prev;
+    tiles->packed_bytes -= tiles->packed_size[tile];
+    tracked_free(MEMORY_COMPRESSED_TILES, tiles->packed[tile]);
+    tiles->packed[tile] = NULL;
+}
+
+/*!
+ * \brief Decompress tile data
+ * \param tiles tile store
+ * \param tile tile index
+ * \param[out] data buffer for the tile
+ */
+static void expand_tile(struct TileStore *tiles, size_t tile, char *data)
+{
+    int size = tile_end(tiles, tile) - tile_start(tiles, tile);
+
+    /* tiles which don't compress are kept as they are */
+    if (tiles->packed_size[tile] == size)
+        memcpy(data, tiles->packed[tile], size);
+    else if (G_expand(tiles->packed[tile], tiles->packed_size[tile],
+                      (unsigned char *) data, size, tiles->compressor) != size)
+        G_fatal_error(_("Unable to decompress tile"));
+}
+
+/*!
+ * \brief Remove least recently compressed tile, writing it to file if modified
+ * \param tiles tile store
+ */
+static void spill_tile(struct TileStore *tiles)
+{
+    size_t tile = tiles->packed_tail;
+
+    if (tiles->packed_dirty[tile]) {
+        expand_tile(tiles, tile, tiles->spill_buffer);
+        transfer_tile(tiles, tile, tiles->spill_buffer, true);
+        tiles->writes++;
+        tiles->spills++;
+    }
+    packed_remove(tiles, tile);
+}
+
+/*!
+ * \brief Compress tile of a slot and keep it in memory
+ *
+ * Tiles which were never written are not kept, they are all zeros.
+ *
+ * \param tiles tile store
+ * \param slot slot index
+ * \return true if the tile is kept, false if it must be written to file
+ */
+static bool pack_tile(struct TileStore *tiles, int slot)
+{
+    struct TileSlot *s = &tiles->slots[slot];
+    unsigned char *data = (unsigned char *) tiles->cache + slot * tiles->tile_size;
+    int size = tile_end(tiles, s->tile) - tile_start(tiles, s->tile);
+    int packed_size;
+
+    if (!s->dirty && !tiles->written[s->tile])
+        return true;
+    packed_size = G_compress(data, size, tiles->packed_buffer,
+                             G_compress_bound(tiles->tile_size, tiles->compressor),
+                             tiles->compressor);
+    if (packed_size <= 0 || packed_size >= size) {
+        packed_size = size;
+        memcpy(tiles->packed_buffer, data, size);
+    }
+    if ((size_t) packed_size > tiles->packed_limit)
+        return false;
+    while (tiles->packed_bytes + packed_size > tiles->packed_limit)
+        spill_tile(tiles);
+    tiles->packed[s->tile] = tracked_malloc(MEMORY_COMPRESSED_TILES, packed_size);
+    memcpy(tiles->packed[s->tile], tiles->packed_buffer, packed_size);
+    tiles->packed_size[s->tile] = packed_size;
+    tiles->packed_dirty[s->tile] = s->dirty;
+    tiles->packed_bytes += packed_size;
+    tiles->packed_prev[s->tile] = tiles->ntiles;
+    tiles->packed_next[s->tile] = tiles->packed_head;
+    if (tiles->packed_head < tiles->ntiles)
+        tiles->packed_prev[tiles->packed_head] = s->tile;
+    else
+        tiles->packed_tail = s->tile;
+    tiles->packed_head = s->tile;
+    tiles->packs++;
+    tiles->raw_bytes += size;
+    tiles->packed_total += packed_size;
+    return true;
+}
+
+static void list_remove(struct TileStore *tiles, int slot)
+{
+    struct TileSlot *s = &tiles->slots[slot];
+
+    if (s->prev >= 0)
+        tiles->slots[s->prev].next = s->next;
+    else
+        tiles->head[s->list] = s->next;
+    if (s->next >= 0)
+        tiles->slots[s->next].prev = s->prev;
+    else
+        tiles->tail[s->list] = s->prev;
+    if (s->list == PROTECTED)
+        tiles->nprotected--;
+}
+
+static void list_insert(struct TileStore *tiles, int slot, int list, bool at_head)
+{
+    struct TileSlot *s = &tiles->slots[slot];
+
+    s->list = list;
+    if (at_head) {
+        s->prev = -1;
+        s->next = tiles->head[list];
+        if (s->next >= 0)
+            tiles->slots[s->next].prev = slot;
+        else
+            tiles->tail[list] = slot;
+        tiles->head[list] = slot;
+    }
+    else {
+        s->next = -1;
+        s->prev = tiles->tail[list];
+        if (s->prev >= 0)
+            tiles->slots[s->prev].next = slot;
+        else
+            tiles->head[list] = slot;
+        tiles->tail[list] = slot;
+    }
+    if (list == PROTECTED)
+        tiles->nprotected++;
+}
+
+/*!
+ * \brief Find least recently used tile which is not pinned
+ *
+ * Probationary tiles are evicted first.
+ *
+ * \param tiles tile store
+ * \return slot index or -1 if all tiles are pinned
+ */
+static int get_lru_slot(struct TileStore *tiles)
+{
+    int slot, list;
+
+    for (list = PROBATION; list <= PROTECTED; list++) {
+        for (slot = tiles->tail[list]; slot >= 0; slot = tiles->slots[slot].prev)
+            if (!tiles->slots[slot].pinned)
+                return slot;
+    }
+    return -1;
+}
+
+/*!
+ * \brief Remove tile from cache
+ *
+ * Evicted tile is compressed in memory when possible,
+ * otherwise it is written to file if modified.
+ *
+ * \param tiles tile store
+ * \param slot slot index
+ */
+static void evict_slot(struct TileStore *tiles, int slot)
+{
+    bool kept;
+    struct TileSlot *s = &tiles->slots[slot];
+
+    kept = tiles->compressor && pack_tile(tiles, slot);
+    if (s->dirty && !kept) {
+        transfer_tile(tiles, s->tile, tiles->cache + slot * tiles->tile_size, true);
+        tiles->writes++;
+    }
+    list_remove(tiles, slot);
+    tiles->tile_slot[s->tile] = -1;
+    if (tiles->last_slot == slot)
+        tiles->last_tile = tiles->ntiles;
+}
+
+/*!
+ * \brief Find slot for a new tile, evicting the least recently used one
+ *
+ * Pinned tiles are never evicted.
+ *
+ * \param tiles tile store
+ * \return slot index
+ */
+static int get_free_slot(struct TileStore *tiles)
+{
+    int slot;
+
+    if (tiles->nused < tiles->nslots)
+        return tiles->nused++;
+    slot = get_lru_slot(tiles);
+    if (slot < 0)
+        G_fatal_error(_("All cached tiles are pinned"));
+    evict_slot(tiles, slot);
+    return slot;
+}
+
+/*!
+ * \brief Move cached tile to another (free) slot
+ * \param tiles tile store
+ * \param from slot index of the tile
+ * \param to index of free slot
+ */
+static void move_slot(struct TileStore *tiles, int from, int to)
+{
+    struct TileSlot *s;
+
+    memcpy(tiles->cache + to * tiles->tile_size, tiles->cache + from * tiles->tile_size,
+           tiles->tile_size);
+    tiles->slots[to] = tiles->slots[from];
+    s = &tiles->slots[to];
+    if (s->prev >= 0)
+        tiles->slots[s->prev].next = to;
+    else
+        tiles->head[s->list] = to;
+    if (s->next >= 0)
+        tiles->slots[s->next].prev = to;
+    else
+        tiles->tail[s->list] = to;
+    tiles->tile_slot[s->tile] = to;
+}
+
+/*!
+ * \brief Reduce number of cached tiles
+ *
+ * Least recently used tiles are evicted and the memory is released.
+ * Pinned tiles are kept, so the cache can remain larger than requested.
+ *
+ * \param tiles tile store
+ * \param nslots new number of cached tiles (at least 1)
+ */
+void TileStore_shrink(struct TileStore *tiles, int nslots)
+{
+    int slot, free_slot, count;
+
+    if (tiles->map || nslots >= tiles->nslots)
+        return;
+    if (nslots < 1)
+        nslots = 1;
+    count = tiles->nused;
+    while (count > nslots) {
+        slot = get_lru_slot(tiles);
+        if (slot < 0)
+            break;
+        evict_slot(tiles, slot);
+        count--;
+    }
+    if (count > nslots)
+        nslots = count;
+    /* move remaining tiles to the beginning, slots not holding their tile are free */
+    free_slot = 0;
+    for (slot = count; slot < tiles->nused; slot++) {
+        if (tiles->tile_slot[tiles->slots[slot].tile] != slot)
+            continue;
+        while (tiles->tile_slot[tiles->slots[free_slot].tile] == free_slot)
+            free_slot++;
+        move_slot(tiles, slot, free_slot);
+    }
+    tiles->nused = count;
+    tiles->nslots = nslots;
+    tiles->last_tile = tiles->ntiles;
+    tiles->cache = tracked_realloc(MEMORY_TILES, tiles->cache, nslots * tiles->tile_size);
+    tiles->slots = tracked_realloc(MEMORY_TILES, tiles->slots, nslots * sizeof(struct TileSlot));
+}
+
+/*!
+ * \brief Get cached tile, reading it from file if needed
+ * \param tiles tile store
+ * \param tile tile index
+ * \param write tile is going to be modified
+ * \return pointer to tile data
+ */
+void *TileStore_cache_tile(struct TileStore *tiles, size_t tile, bool write)
+{
+    int slot;
+    struct TileSlot *s;
+
+    if (tile == tiles->last_tile) {
+        tiles->hits++;
+        tiles->slots[tiles->last_slot].dirty |= write;
+        return tiles->cache + tiles->last_slot * tiles->tile_size;
+    }
+    slot = tiles->tile_slot[tile];
+    if (slot >= 0) {
+        tiles->hits++;
+        s = &tiles->slots[slot];
+        /* sweep doesn't promote tiles to protected */
+        if (!tiles->scan) {
+            list_remove(tiles, slot);
+            list_insert(tiles, slot, PROTECTED, true);
+            /* demote least recently used protected tile */
+            if (tiles->nprotected > PROTECTED_FRACTION * tiles->nslots) {
+                slot = tiles->tail[PROTECTED];
+                list_remove(tiles, slot);
+                list_insert(tiles, slot, PROBATION, true);
+                slot = tiles->tile_slot[tile];
+            }
+        }
+    }
+    else {
+        tiles->misses++;
+        slot = get_free_slot(tiles);
+        s = &tiles->slots[slot];
+        s->tile = tile;
+        s->dirty = false;
+        s->pinned = 0;
+        if (tiles->compressor && tiles->packed[tile]) {
+            /* modified compressed tile is modified in cache again */
+            expand_tile(tiles, tile, tiles->cache + slot * tiles->tile_size);
+            s->dirty = tiles->packed_dirty[tile];
+            packed_remove(tiles, tile);
+            tiles->unpacks++;
+        }
+        else
+            transfer_tile(tiles, tile, tiles->cache + slot * tiles->tile_size, false);
+        tiles->tile_slot[tile] = slot;
+        /* tiles read by sweep are evicted first */
+        list_insert(tiles, slot, PROBATION, !tiles->scan);
+    }
+    s = &tiles->slots[slot];
+    s->dirty |= write;
+    tiles->last_tile = tile;
+    tiles->last_slot = slot;
+
+    return tiles->cache + slot * tiles->tile_size;
+}
+
+/*!
+ * \brief Write all modified cached tiles to file
+ *
+ * Both tiles in cache slots and modified tiles kept compressed
+ * are written, the compressed tiles stay in memory as unmodified.
+ *
+ * \param tiles tile store
+ */
+void TileStore_flush(struct TileStore *tiles)
+{
+    int slot;
+    size_t tile;
+
+    if (tiles->map)
+        return;
+    for (slot = 0; slot < tiles->nused; slot++)
+        if (tiles->slots[slot].dirty) {
+            transfer_tile(tiles, tiles->slots[slot].tile,
+                          tiles->cache + slot * tiles->tile_size, true);
+            tiles->slots[slot].dirty = false;
+            tiles->writes++;
+        }
+    if (!tiles->compressor)
+        return;
+    for (tile = tiles->packed_head; tile < tiles->ntiles; tile = tiles->packed_next[tile])
+        if (tiles->packed_dirty[tile]) {
+            expand_tile(tiles, tile, tiles->spill_buffer);
+            transfer_tile(tiles, tile, tiles->spill_buffer, true);
+            tiles->packed_dirty[tile] = false;
+            tiles->writes++;
+        }
+}
+
+/*!
+ * \brief Copy row of cells to buffer
+ * \param tiles tile store
+ * \param[out] buf buffer for cols * len bytes
+ * \param row row
+ */
+void TileStore_get_row(struct TileStore *tiles, void *buf, int row)
+{
+    int col, ncols;
+
+    if (tiles->valid) {
+        for (col = ValidCells_next(tiles->valid, row, 0); col < tiles->cols;
+             col = ValidCells_next(tiles->valid, row, col + 1))
+            memcpy((char *) buf + (size_t) col * tiles->len,
+                   TileStore_address(tiles, row, col, false), tiles->len);
+        return;
+    }
+    for (col = 0; col < tiles->cols; col += tiles->tile_cols) {
+        ncols = tiles->cols - col < tiles->tile_cols ? tiles->cols - col : tiles->tile_cols;
+        memcpy((char *) buf + (size_t) col * tiles->len,
+               TileStore_address(tiles, row, col, false), (size_t) ncols * tiles->len);
+    }
+}
+
+/*!
+ * \brief Copy row of cells from buffer
+ * \param tiles tile store
+ * \param buf buffer of cols * len bytes
+ * \param row row
+ */
+void TileStore_put_row(struct TileStore *tiles, const void *buf, int row)
+{
+    int col, ncols;
+
+    if (tiles->valid) {
+        for (col = ValidCells_next(tiles->valid, row, 0); col < tiles->cols;
+             col = ValidCells_next(tiles->valid, row, col + 1))
+            memcpy(TileStore_address(tiles, row, col, true),
+                   (const char *) buf + (size_t) col * tiles->len, tiles->len);
+        return;
+    }
+    for (col = 0; col < tiles->cols; col += tiles->tile_cols) {
+        ncols = tiles->cols - col < tiles->tile_cols ? tiles->cols - col : tiles->tile_cols;
+        memcpy(TileStore_address(tiles, row, col, true),
+               (const char *) buf + (size_t) col * tiles->len, (size_t) ncols * tiles->len);
+    }
+}
+
+/*!
+ * \brief Start reading tiles which are not cached in the background
+ *
+ * The kernel reads the tiles into its page cache while the simulation
+ * continues, so that a later miss doesn't wait for the disk.
+ * Only tiles which are not in memory and were written are read.
+ *
+ * \param tiles tile store with cached tiles
+ * \param tile_row tile row
+ * \param tile_col1 first tile column
+ * \param tile_col2 last tile column
+ */
+static void prefetch_tiles(struct TileStore *tiles, int tile_row, int tile_col1, int tile_col2)
+{
+    int tile_col;
+    size_t tile;
+    size_t start, end;
+
+    start = end = 0;
+    for (tile_col = tile_col1; tile_col <= tile_col2 + 1; tile_col++) {
+        tile = (size_t) tile_row * tiles->ntile_cols + tile_col;
+        if (tile_col <= tile_col2 && tiles->tile_slot[tile] < 0 && tiles->written[tile]
+                && !(tiles->compressor && tiles->packed[tile])) {
+            /* tiles in one tile row are next to each other in the file */
+            if (end == tile_start(tiles, tile))
+                end = tile_end(tiles, tile);
+            else {
+                if (end > start)
+                    posix_fadvise(tiles->fd, start, end - start, POSIX_FADV_WILLNEED);
+                start = tile_start(tiles, tile);
+                end = tile_end(tiles, tile);
+            }
+            tiles->prefetches++;
+        }
+        else if (end > start) {
+            posix_fadvise(tiles->fd, start, end - start, POSIX_FADV_WILLNEED);
+            start = end = 0;
+        }
+    }
+}
+
+/*!
+ * \brief Advise the kernel about future use of tiles in a window
+ *
+ * WILLNEED starts reading the tiles in the background,
+ * DONTNEED allows the kernel to drop the tiles from memory
+ * (they are written to the file first).
+ * For cached tiles, only WILLNEED has effect and it reads
+ * the tiles which are not cached.
+ *
+ * \param tiles tile store
+ * \param row1 first row of the window (can be outside)
+ * \param col1 first column of the window (can be outside)
+ * \param row2 last row of the window (can be outside)
+ * \param col2 last column of the window (can be outside)
+ * \param advice WILLNEED or DONTNEED
+ */
+void TileStore_advise(struct TileStore *tiles, int row1, int col1, int row2, int col2,
+                      enum tile_advice advice)
+{
+    int tile_row, tile_col1, tile_col2;
+    int tile_col;
+    size_t tile, start, end;
+    size_t page_size;
+
+    if (row1 < 0)
+        row1 = 0;
+    if (col1 < 0)
+        col1 = 0;
+    if (row2 >= tiles->rows)
+        row2 = tiles->rows - 1;
+    if (col2 >= tiles->cols)
+        col2 = tiles->cols - 1;
+    if (row1 > row2 || col1 > col2)
+        return;
+    tile_col1 = col1 / tiles->tile_cols;
+    tile_col2 = col2 / tiles->tile_cols;
+    if (!tiles->map) {
+        if (advice == TILES_WILLNEED)
+            for (tile_row = row1 / tiles->tile_rows; tile_row <= row2 / tiles->tile_rows;
+                 tile_row++)
+                prefetch_tiles(tiles, tile_row, tile_col1, tile_col2);
+        return;
+    }
+    page_size = sysconf(_SC_PAGESIZE);
+    for (tile_row = row1 / tiles->tile_rows; tile_row <= row2 / tiles->tile_rows; tile_row++) {
+        start = end = 0;
+        for (tile_col = tile_col1; tile_col <= tile_col2 + 1; tile_col++) {
+            tile = (size_t) tile_row * tiles->ntile_cols + tile_col;
+            /* tiles next to each other in the file are advised together */
+            if (tile_col <= tile_col2 && end > start && tile_start(tiles, tile) == end) {
+                end = tile_end(tiles, tile);
+                continue;
+            }
+            /* compact tiles are not page aligned */
+            start = start / page_size * page_size;
+            if (end > start)
+                madvise(tiles->map + start, end - start,
+                        advice == TILES_WILLNEED ? MADV_WILLNEED : MADV_DONTNEED);
+            if (tile_col <= tile_col2) {
+                start = tile_start(tiles, tile);
+                end = tile_end(tiles, tile);
+            }
+        }
+    }
+}
+
+/*!
+ * \brief Load tiles in a window to cache and keep them there until unpinned
+ *
+ * At most half of the cache can be pinned, the remaining tiles
+ * are not pinned (reported the first time it happens).
+ * Memory-mapped tiles are only advised as needed.
+ *
+ * \param tiles tile store
+ * \param row1 first row of the window (can be outside)
+ * \param col1 first column of the window (can be outside)
+ * \param row2 last row of the window (can be outside)
+ * \param col2 last column of the window (can be outside)
+ */
+void TileStore_pin(struct TileStore *tiles, int row1, int col1, int row2, int col2)
+{
+    int tile_row, tile_col;
+    int requested, pinned;
+    size_t tile;
+
+    if (tiles->map) {
+        TileStore_advise(tiles, row1, col1, row2, col2, TILES_WILLNEED);
+        return;
+    }
+    /* start reading all missing tiles before waiting for the first one */
+    TileStore_advise(tiles, row1, col1, row2, col2, TILES_WILLNEED);
+    if (row1 < 0)
+        row1 = 0;
+    if (col1 < 0)
+        col1 = 0;
+    if (row2 >= tiles->rows)
+        row2 = tiles->rows - 1;
+    if (col2 >= tiles->cols)
+        col2 = tiles->cols - 1;
+    requested = pinned = 0;
+    for (tile_row = row1 / tiles->tile_rows; tile_row <= row2 / tiles->tile_rows; tile_row++) {
+        for (tile_col = col1 / tiles->tile_cols; tile_col <= col2 / tiles->tile_cols; tile_col++) {
+            requested++;
+            if (tiles->npinned >= tiles->nslots / 2)
+                continue;
+            tile = (size_t) tile_row * tiles->ntile_cols + tile_col;
+            TileStore_cache_tile(tiles, tile, false);
+            tiles->slots[tiles->tile_slot[tile]].pinned++;
+            tiles->npinned++;
+            pinned++;
+        }
+    }
+    if (pinned < requested && !tiles->pin_limited) {
+        tiles->pin_limited = true;
+        G_verbose_message(_("Only %d of %d tiles around a patch kept in cache of %d tiles, "
+                            "increase memory to keep all of them"),
+                          pinned, requested, tiles->nslots);
+    }
+}
+
+/*!
+ * \brief Unpin all pinned tiles
+ * \param tiles tile store
+ */
+void TileStore_unpin(struct TileStore *tiles)
+{
+    int slot;
+
+    if (tiles->map || !tiles->npinned)
+        return;
+    for (slot = 0; slot < tiles->nused; slot++)
+        tiles->slots[slot].pinned = 0;
+    tiles->npinned = 0;
+}
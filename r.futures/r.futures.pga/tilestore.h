@@ -0,0 +1,136 @@
+#ifndef FUTURES_TILESTORE_H
+#define FUTURES_TILESTORE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "validcells.h"
+
+enum tile_advice {TILES_WILLNEED, TILES_DONTNEED};
+
+struct TileSlot
+{
+    size_t tile;
+    // position in the list of probationary or protected tiles
+    int prev;
+    int next;
+    int list;
+    int pinned;
+    bool dirty;
+};
+
+struct TileStore
+{
+    int rows;
+    int cols;
+    int tile_rows;
+    int tile_cols;
+    // size of cell in bytes
+    int len;
+    int ntile_rows;
+    int ntile_cols;
+    size_t ntiles;
+    // size of tile data and distance between tiles (page aligned)
+    size_t tile_size;
+    size_t tile_stride;
+    // only valid cells are stored (tile by tile) when not NULL
+    const struct ValidCells *valid;
+    // position of each tile in the file in bytes
+    size_t *offset;
+    int fd;
+    // memory-mapped file or NULL when tiles are cached
+    char *map;
+    size_t map_size;
+    // cache of tiles (segmented LRU)
+    char *cache;
+    struct TileSlot *slots;
+    int nslots;
+    int nused;
+    int *tile_slot;
+    // tile was written to file at least once
+    bool *written;
+    int head[2];
+    int tail[2];
+    int nprotected;
+    int npinned;
+    // pinning was limited to half of the cache (reported once)
+    bool pin_limited;
+    size_t last_tile;
+    int last_slot;
+    // accesses are part of a sweep over all tiles
+    bool scan;
+    // GRASS compressor for evicted tiles kept in memory (0 for none)
+    int compressor;
+    // compressed tiles with their size (NULL when not compressed)
+    unsigned char **packed;
+    int *packed_size;
+    bool *packed_dirty;
+    size_t packed_bytes;
+    size_t packed_limit;
+    // order of compressed tiles, least recent is spilled to disk first
+    size_t *packed_prev;
+    size_t *packed_next;
+    size_t packed_head;
+    size_t packed_tail;
+    unsigned char *packed_buffer;
+    char *spill_buffer;
+    // statistics
+    size_t hits;
+    size_t misses;
+    size_t writes;
+    size_t prefetches;
+    size_t packs;
+    size_t unpacks;
+    size_t spills;
+    size_t raw_bytes;
+    size_t packed_total;
+};
+
+void TileStore_open(struct TileStore *tiles, const char *filename,
+                    int rows, int cols, int tile_rows, int tile_cols, int len,
+                    int cache_tiles, const struct ValidCells *valid, const size_t *order);
+void TileStore_set_compression(struct TileStore *tiles, int compressor, size_t limit);
+void TileStore_close(struct TileStore *tiles);
+void *TileStore_cache_tile(struct TileStore *tiles, size_t tile, bool write);
+void TileStore_get_row(struct TileStore *tiles, void *buf, int row);
+void TileStore_put_row(struct TileStore *tiles, const void *buf, int row);
+void TileStore_flush(struct TileStore *tiles);
+void TileStore_shrink(struct TileStore *tiles, int nslots);
+void TileStore_advise(struct TileStore *tiles, int row1, int col1, int row2, int col2,
+                      enum tile_advice advice);
+void TileStore_pin(struct TileStore *tiles, int row1, int col1, int row2, int col2);
+void TileStore_unpin(struct TileStore *tiles);
+
+/*!
+ * \brief Get address of a cell in a tile store
+ *
+ * With cached tiles, the address is valid only until next access.
+ * When only valid cells are stored, there is no address for other cells.
+ *
+ * \param tiles tile store
+ * \param row row
+ * \param col column
+ * \param write cell is going to be modified
+ * \return pointer to the cell or NULL for cell which is not stored
+ */
+static inline void *TileStore_address(struct TileStore *tiles, int row, int col, bool write)
+{
+    size_t tile = (size_t) (row / tiles->tile_rows) * tiles->ntile_cols + col / tiles->tile_cols;
+    size_t cell;
+    char *base;
+
+    if (tiles->valid) {
+        if (!ValidCells_is_valid(tiles->valid, row, col))
+            return NULL;
+        cell = ValidCells_rank_in_tile(tiles->valid, row, col);
+    }
+    else
+        cell = (size_t) (row % tiles->tile_rows) * tiles->tile_cols + col % tiles->tile_cols;
+    if (tiles->map)
+        base = tiles->map + tiles->offset[tile];
+    else
+        base = (char *) TileStore_cache_tile(tiles, tile, write);
+    return base + cell * tiles->len;
+}
+
+#endif // FUTURES_TILESTORE_H
@@ -35,7 +35,7 @@ double get_distance(int row1, int col1, int row2, int col2)
  */
 size_t get_idx_from_xy(int row, int col, int cols)
 {
-    return cols * row + col;
+    return (size_t) cols * row + col;
 }
 
 /*!
@@ -0,0 +1,133 @@
+/*!
+   \file validcells.c
+
+   \brief Index of cells with data in the computational region
+
+   Study areas are often irregular, so many cells in the region
+   have no data. The index is a bitmap of valid cells together with
+   the number of valid cells before each tile and before each row
+   within a tile, so that tiles can store only their valid cells
+   and a cell can still be found in constant time.
+
+   (C) 2020 by Anna Petrasova, Vaclav Petras and the GRASS Development Team
+
+   This program is free software under the GNU General Public License
+   (>=v2).  Read the file COPYING that comes with GRASS for details.
+
+   \author Anna Petrasova
+   \author Vaclav Petras
+ */
+
+#include <limits.h>
+
+#include <grass/gis.h>
+#include <grass/glocale.h>
+
+#include "validcells.h"
+#include "memusage.h"
+
+/*!
+ * \brief Create index with no valid cells
+ * \param valid valid cells
+ * \param rows number of rows
+ * \param cols number of columns
+ * \param tile_rows number of rows in a tile
+ * \param tile_cols number of columns in a tile
+ */
+void ValidCells_create(struct ValidCells *valid, int rows, int cols,
+                       int tile_rows, int tile_cols)
+{
+    if ((size_t) (tile_rows - 1) * tile_cols > USHRT_MAX)
+        G_fatal_error(_("Tile of %dx%d cells is too large for index of valid cells"),
+                      tile_rows, tile_cols);
+    valid->rows = rows;
+    valid->cols = cols;
+    valid->tile_rows = tile_rows;
+    valid->tile_cols = tile_cols;
+    valid->ntile_rows = (rows + tile_rows - 1) / tile_rows;
+    valid->ntile_cols = (cols + tile_cols - 1) / tile_cols;
+    valid->words = (cols + 63) / 64;
+    valid->bits = tracked_calloc(MEMORY_CELL_INDEX, (size_t) rows * valid->words,
+                                 sizeof(uint64_t));
+    valid->row_offset = NULL;
+    valid->tile_offset = NULL;
+    valid->count = 0;
+}
+
+/*!
+ * \brief Set which cells of a row are valid
+ * \param valid valid cells
+ * \param row row
+ * \param row_valid true for each valid cell in the row
+ */
+void ValidCells_set_row(struct ValidCells *valid, int row, const bool *row_valid)
+{
+    int col;
+    uint64_t *bits = valid->bits + (size_t) row * valid->words;
+
+    for (col = 0; col < valid->cols; col++) {
+        if (row_valid[col])
+            bits[col / 64] |= (uint64_t) 1 << (col % 64);
+        else
+            bits[col / 64] &= ~((uint64_t) 1 << (col % 64));
+    }
+}
+
+/*!
+ * \brief Compute number of valid cells before each tile and tile row
+ *
+ * Must be called after all rows are set.
+ *
+ * \param valid valid cells
+ */
+void ValidCells_index(struct ValidCells *valid)
+{
+    int row, tile_row, tile_col;
+    int col1, col2;
+    int *in_tile;
+    size_t tile;
+
+    tracked_free(MEMORY_CELL_INDEX, valid->row_offset);
+    tracked_free(MEMORY_CELL_INDEX, valid->tile_offset);
+    valid->row_offset = tracked_malloc(MEMORY_CELL_INDEX, (size_t) valid->rows * valid->ntile_cols
+                                       * sizeof(unsigned short));
+    valid->tile_offset = tracked_malloc(MEMORY_CELL_INDEX,
+                                        ((size_t) valid->ntile_rows * valid->ntile_cols + 1)
+                                        * sizeof(size_t));
+    in_tile = G_malloc(valid->ntile_cols * sizeof(int));
+    valid->count = 0;
+    for (tile_row = 0; tile_row < valid->ntile_rows; tile_row++) {
+        for (tile_col = 0; tile_col < valid->ntile_cols; tile_col++)
+            in_tile[tile_col] = 0;
+        for (row = tile_row * valid->tile_rows;
+             row < valid->rows && row < (tile_row + 1) * valid->tile_rows; row++) {
+            for (tile_col = 0; tile_col < valid->ntile_cols; tile_col++) {
+                valid->row_offset[(size_t) row * valid->ntile_cols + tile_col] = in_tile[tile_col];
+                col1 = tile_col * valid->tile_cols;
+                col2 = col1 + valid->tile_cols < valid->cols ? col1 + valid->tile_cols : valid->cols;
+                in_tile[tile_col] += ValidCells_count(valid, row, col1, col2);
+            }
+        }
+        for (tile_col = 0; tile_col < valid->ntile_cols; tile_col++) {
+            tile = (size_t) tile_row * valid->ntile_cols + tile_col;
+            valid->tile_offset[tile] = valid->count;
+            valid->count += in_tile[tile_col];
+        }
+    }
+    valid->tile_offset[(size_t) valid->ntile_rows * valid->ntile_cols] = valid->count;
+    G_free(in_tile);
+}
+
+/*!
+ * \brief Free the index
+ * \param valid valid cells
+ */
+void ValidCells_free(struct ValidCells *valid)
+{
+    tracked_free(MEMORY_CELL_INDEX, valid->bits);
+    tracked_free(MEMORY_CELL_INDEX, valid->row_offset);
+    tracked_free(MEMORY_CELL_INDEX, valid->tile_offset);
+    valid->bits = NULL;
+    valid->row_offset = NULL;
+    valid->tile_offset = NULL;
+}
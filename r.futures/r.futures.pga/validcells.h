@@ -0,0 +1,145 @@
+#ifndef FUTURES_VALIDCELLS_H
+#define FUTURES_VALIDCELLS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* bitmap of cells with data with rank of each cell within its tile */
+struct ValidCells
+{
+    int rows;
+    int cols;
+    int tile_rows;
+    int tile_cols;
+    int ntile_rows;
+    int ntile_cols;
+    // number of 64-bit words per row of the bitmap
+    int words;
+    uint64_t *bits;
+    // valid cells of the same tile in rows above (for each row and tile column)
+    unsigned short *row_offset;
+    // valid cells in all preceding tiles (number of tiles + 1 items)
+    size_t *tile_offset;
+    // number of valid cells
+    size_t count;
+};
+
+void ValidCells_create(struct ValidCells *valid, int rows, int cols,
+                       int tile_rows, int tile_cols);
+void ValidCells_set_row(struct ValidCells *valid, int row, const bool *row_valid);
+void ValidCells_index(struct ValidCells *valid);
+void ValidCells_free(struct ValidCells *valid);
+
+static inline int ValidCells_popcount(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    int n;
+
+    for (n = 0; word; word &= word - 1)
+        n++;
+    return n;
+#endif
+}
+
+static inline int ValidCells_ctz(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int n;
+
+    for (n = 0; !(word & 1); word >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+/*!
+ * \brief Test if cell has data
+ * \param valid valid cells
+ * \param row row
+ * \param col column
+ * \return true if valid
+ */
+static inline bool ValidCells_is_valid(const struct ValidCells *valid, int row, int col)
+{
+    return (valid->bits[(size_t) row * valid->words + col / 64] >> (col % 64)) & 1;
+}
+
+/*!
+ * \brief Count valid cells in a part of a row
+ * \param valid valid cells
+ * \param row row
+ * \param col1 first column
+ * \param col2 column after the last column
+ * \return number of valid cells
+ */
+static inline int ValidCells_count(const struct ValidCells *valid, int row, int col1, int col2)
+{
+    const uint64_t *bits = valid->bits + (size_t) row * valid->words;
+    int w, w1, w2;
+    int n;
+    uint64_t first;
+
+    if (col1 >= col2)
+        return 0;
+    w1 = col1 / 64;
+    w2 = col2 / 64;
+    first = bits[w1] & (~(uint64_t) 0 << (col1 % 64));
+    if (w1 == w2)
+        return ValidCells_popcount(first & (((uint64_t) 1 << (col2 % 64)) - 1));
+    n = ValidCells_popcount(first);
+    for (w = w1 + 1; w < w2; w++)
+        n += ValidCells_popcount(bits[w]);
+    if (col2 % 64)
+        n += ValidCells_popcount(bits[w2] & (((uint64_t) 1 << (col2 % 64)) - 1));
+    return n;
+}
+
+/*!
+ * \brief Get position of a valid cell among valid cells of its tile
+ *
+ * Cells in a tile are ordered by rows.
+ *
+ * \param valid valid cells
+ * \param row row
+ * \param col column
+ * \return rank of the cell in its tile
+ */
+static inline size_t ValidCells_rank_in_tile(const struct ValidCells *valid, int row, int col)
+{
+    int tile_col = col / valid->tile_cols;
+
+    return valid->row_offset[(size_t) row * valid->ntile_cols + tile_col]
+            + ValidCells_count(valid, row, tile_col * valid->tile_cols, col);
+}
+
+/*!
+ * \brief Get next valid cell in a row
+ * \param valid valid cells
+ * \param row row
+ * \param col column to start from (included)
+ * \return column of the next valid cell or number of columns if there is none
+ */
+static inline int ValidCells_next(const struct ValidCells *valid, int row, int col)
+{
+    const uint64_t *bits = valid->bits + (size_t) row * valid->words;
+    int w;
+    uint64_t word;
+
+    if (col >= valid->cols)
+        return valid->cols;
+    w = col / 64;
+    word = bits[w] & (~(uint64_t) 0 << (col % 64));
+    while (!word) {
+        if (++w >= valid->words)
+            return valid->cols;
+        word = bits[w];
+    }
+    return w * 64 + ValidCells_ctz(word);
+}
+
+#endif // FUTURES_VALIDCELLS_H